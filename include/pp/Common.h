@@ -130,6 +130,9 @@ inline EMods MaskRelevantDifficultyMods(EGamemode mode, EMods mods)
 
 std::string ToString(EMods mods);
 
+// Parses concatenated mod acronyms such as "HDDT". "NM" denotes no mods.
+EMods ToMods(std::string modsString);
+
 std::string GamemodeSuffix(EGamemode gamemode);
 std::string GamemodeName(EGamemode gamemode);
 std::string GamemodeTag(EGamemode gamemode);
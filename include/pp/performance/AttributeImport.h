@@ -0,0 +1,44 @@
+#pragma once
+
+#include <pp/Common.h>
+
+#include <pp/performance/Beatmap.h>
+
+#include <vector>
+
+PP_NAMESPACE_BEGIN
+
+DEFINE_EXCEPTION(AttributeImportException);
+
+// Reads difficulty attributes from the bulk output of the difficulty calculator instead of `osu_beatmap_difficulty_attribs`.
+// Attributes are identified by their IDs within `osu_difficulty_attribs`. Two formats are understood:
+// - One JSON object per line and per beatmap and mod combination, e.g.
+//   {"beatmap_id":75,"mode":0,"mods":64,"attributes":{"1":2.81,"3":1.92,"9":573}}
+// - Packed little-endian binary, starting with the magic "ppattrs1", the u32 game mode, the u32 number N of
+//   attributes and their N u32 IDs. Fixed-size records of the s32 beatmap ID, the u32 mods, and N f32 values follow.
+//   Missing values are NaN.
+class AttributeImport
+{
+public:
+	struct Entry
+	{
+		s32 BeatmapId;
+		EMods Mods;
+		Beatmap::attributes_t Attributes;
+	};
+
+	AttributeImport(EGamemode gamemode, std::string filename);
+
+	// Parses the file with the given number of threads. Entries of other game modes are skipped.
+	// attributeTypes maps attribute IDs to their type.
+	std::vector<Entry> Read(const std::vector<Beatmap::EDifficultyAttributeType>& attributeTypes, u32 numThreads);
+
+private:
+	std::vector<Entry> readJson(const std::string& data, const std::vector<Beatmap::EDifficultyAttributeType>& attributeTypes, u32 numThreads);
+	std::vector<Entry> readBinary(const std::string& data, const std::vector<Beatmap::EDifficultyAttributeType>& attributeTypes, u32 numThreads);
+
+	EGamemode _gamemode;
+	std::string _filename;
+};
+
+PP_NAMESPACE_END
@@ -2,6 +2,7 @@
 
 #include <pp/Common.h>
 
+#include <array>
 #include <unordered_map>
 
 PP_NAMESPACE_BEGIN
@@ -44,6 +45,8 @@ class Beatmap
 		ScoreV2 = 2,
 	};
 
+	using attributes_t = std::array<f32, NumTypes>;
+
 	s32 Id() const { return _id; }
 
 	ERankedStatus RankedStatus() const { return _rankedStatus; }
@@ -52,6 +55,10 @@ class Beatmap
 	s32 NumSliders() const { return _numSliders; }
 	s32 NumSpinners() const { return _numSpinners; }
 	f32 DifficultyAttribute(EMods mods, EDifficultyAttributeType type) const;
+	bool HasDifficulty(EMods mods) const;
+
+	// A copy of the general information only, without any difficulty attributes
+	Beatmap WithoutDifficulty() const;
 
 	void SetRankedStatus(ERankedStatus rankedStatus) { _rankedStatus = rankedStatus; }
 	void SetScoreVersion(EScoreVersion scoreVersion) { _scoreVersion = scoreVersion; }
@@ -59,6 +66,7 @@ class Beatmap
 	void SetNumSliders(s32 numSliders) { _numSliders = numSliders; }
 	void SetNumSpinners(s32 numSpinners) { _numSpinners = numSpinners; }
 	void SetDifficultyAttribute(EMods mods, EDifficultyAttributeType type, f32 value);
+	void SetDifficultyAttributes(EMods mods, const attributes_t& attributes);
 	void SetMode(EGamemode mode) { _mode = mode; }
 
 	static bool ContainsAttribute(const std::string &difficultyAttributeName)
@@ -81,7 +89,7 @@ class Beatmap
 	// Calculated difficulty
 	using difficulty_t = std::unordered_map<
 		std::underlying_type_t<EMods>,
-		std::array<f32, NumTypes>>;
+		attributes_t>;
 
 	difficulty_t _difficulty;
 
@@ -4,14 +4,31 @@
 
 #include <curl/curl.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
 typedef void CURL;
 
 PP_NAMESPACE_BEGIN
 
+// Delivers notifications to Slack and Sentry from a background thread through the curl multi interface.
+// Sending only enqueues and never blocks on the network, hence it is safe to do from any thread.
+// The queue is bounded, requests are rate limited, and identical notifications arriving in quick
+// succession are coalesced into a single aggregated message.
 class CURL
 {
 public:
 	CURL();
+	~CURL();
+
+	CURL(const CURL&) = delete;
+	CURL& operator=(const CURL&) = delete;
 
 	void SendToSlack(
 		std::string domain,
@@ -33,7 +50,61 @@ class CURL
 	);
 
 private:
-	std::unique_ptr<::CURL, decltype(&curl_easy_cleanup)> _pCURL;
+	struct Request
+	{
+		std::string Target;
+		std::string URL;
+		std::vector<std::string> Headers;
+		std::string Body;
+	};
+
+	struct Notification
+	{
+		// Notifications with the same key are coalesced
+		std::string Key;
+
+		// Builds the request with the given remark appended to the message
+		std::function<Request(const std::string& remark)> BuildRequest;
+	};
+
+	struct Coalesced
+	{
+		Notification First;
+		std::chrono::steady_clock::time_point WindowStart;
+		size_t NumRepeats;
+	};
+
+	struct Transfer
+	{
+		Request Content;
+		curl_slist* pHeaders;
+	};
+
+	void enqueue(Notification notification);
+
+	void run();
+	void coalesce(Notification notification, std::deque<Request>& ready);
+	void flushCoalesced(bool all, std::deque<Request>& ready);
+	void startTransfer(Request request);
+	void finishTransfers();
+
+	std::unique_ptr<::CURLM, decltype(&curl_multi_cleanup)> _pMulti;
+	std::unordered_map<::CURL*, Transfer> _transfers;
+
+	std::unordered_map<std::string, Coalesced> _coalesced;
+
+	// Token bucket
+	f64 _numTokens;
+	std::chrono::steady_clock::time_point _lastRefillTime;
+
+	std::deque<Notification> _queue;
+	std::mutex _queueMutex;
+	std::condition_variable _queueCondition;
+
+	std::atomic<size_t> _numDropped{0};
+	bool _shallShutdown = false;
+
+	std::thread _thread;
 };
 
 PP_NAMESPACE_END
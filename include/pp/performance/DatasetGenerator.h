@@ -0,0 +1,67 @@
+#pragma once
+
+#include <pp/Common.h>
+
+#include <pp/shared/DatabaseConnection.h>
+
+#include <atomic>
+#include <memory>
+#include <random>
+#include <vector>
+
+PP_NAMESPACE_BEGIN
+
+DEFINE_EXCEPTION(DatasetGeneratorException);
+
+// Fills the tables read by the processor with synthetic beatmaps, users and scores of a single game mode,
+// such that processing can be benchmarked at scale without production data. The tables must already exist,
+// e.g. from a sample dump. Rows with the IDs being generated are replaced.
+class DatasetGenerator
+{
+public:
+	struct Parameters
+	{
+		s64 NumUsers;
+		s32 NumBeatmaps;
+		f64 MeanScoresPerUser;
+		u32 Seed;
+
+		// Removes all rows from the generated tables beforehand
+		bool Truncate;
+
+		std::string UserPPColumnName;
+		std::string UserMetadataTableName;
+	};
+
+	DatasetGenerator(EGamemode gamemode, Parameters parameters);
+
+	// Users are generated in parallel, one thread per connection
+	void Generate(const std::vector<std::shared_ptr<DatabaseConnection>>& dbConnections);
+
+	s64 MaxScoreId() const { return _nextScoreId - 1; }
+
+private:
+	struct GeneratedBeatmap
+	{
+		s32 NumHitCircles;
+		s32 NumSliders;
+		s32 NumSpinners;
+		s32 MaxCombo;
+	};
+
+	void truncateTables(DatabaseConnection& db);
+	void generateDifficultyAttributeNames(DatabaseConnection& db);
+	void generateBeatmaps(DatabaseConnection& db);
+	void generateUsers(DatabaseConnection& db, s64 firstUserId, s64 endUserId, u32 threadIndex);
+
+	EGamemode _gamemode;
+	Parameters _parameters;
+
+	// Indexed by beatmap ID - 1
+	std::vector<GeneratedBeatmap> _beatmaps;
+
+	std::atomic<s64> _nextScoreId{1};
+	std::atomic<s64> _numUsersGenerated{0};
+};
+
+PP_NAMESPACE_END
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <pp/Common.h>
+#include <pp/performance/Formulas.h>
+#include <pp/performance/User.h>
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+PP_NAMESPACE_BEGIN
+
+DEFINE_EXCEPTION(FormulaComparisonException);
+
+// Evaluates candidate formulas on the scores pp are computed for with the current formula anyway, such that
+// a rework can be compared without fetching every score once per formula. The pp of every score and user under
+// each formula are streamed into a file of one JSON object per line, e.g.
+// {"score_id":5,"user_id":2,"beatmap_id":75,"pp":{"current":120.5,"aim-rework":126.1}}
+// {"user_id":2,"pp":{"current":4012.3,"aim-rework":4100.9}}
+class FormulaComparison
+{
+public:
+	FormulaComparison(EGamemode gamemode, const std::vector<std::string>& candidateNames, std::string filename);
+
+	// Gathers the scores of a single user. Not thread safe.
+	class UserComparison
+	{
+	public:
+		UserComparison(const FormulaComparison& comparison, s64 userId);
+
+		void AddScore(
+			f32 currentValue,
+			s64 scoreId,
+			s32 beatmapId,
+			s32 score,
+			s32 maxCombo,
+			s32 num300,
+			s32 num100,
+			s32 num50,
+			s32 numMiss,
+			s32 numGeki,
+			s32 numKatu,
+			EMods mods,
+			const Beatmap& beatmap
+		);
+
+	private:
+		friend class FormulaComparison;
+
+		const FormulaComparison& _comparison;
+		s64 _userId;
+
+		std::vector<User> _candidateUsers;
+		std::string _lines;
+	};
+
+	std::unique_ptr<UserComparison> BeginUser(s64 userId) const;
+
+	// Computes the totals of each candidate and writes the user's comparison. Thread safe.
+	void EndUser(UserComparison& user, f64 currentValue);
+
+	void LogSummary() const;
+
+private:
+	std::string ppObject(f64 currentValue, const std::vector<f64>& candidateValues) const;
+
+	EGamemode _gamemode;
+	std::vector<const Formulas::Candidate*> _candidates;
+
+	std::string _filename;
+	std::ofstream _file;
+
+	mutable std::mutex _mutex;
+
+	s64 _numUsers = 0;
+	f64 _currentTotal = 0;
+	std::vector<f64> _candidateTotals;
+	std::vector<f64> _candidateAbsoluteChanges;
+};
+
+PP_NAMESPACE_END
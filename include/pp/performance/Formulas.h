@@ -0,0 +1,75 @@
+#pragma once
+
+#include <pp/Common.h>
+#include <pp/performance/Beatmap.h>
+#include <pp/performance/Score.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+PP_NAMESPACE_BEGIN
+
+DEFINE_EXCEPTION(FormulasException);
+
+// Registry of candidate pp formulas, e.g. of a rework, which can be evaluated side by side with the current ones.
+// Each candidate is a Score class of its own, registered under a unique name in Formulas.cpp.
+class Formulas
+{
+public:
+	using factory_t = std::function<std::unique_ptr<Score>(
+		s64 scoreId,
+		EGamemode mode,
+		s64 userId,
+		s32 beatmapId,
+		s32 score,
+		s32 maxCombo,
+		s32 num300,
+		s32 num100,
+		s32 num50,
+		s32 numMiss,
+		s32 numGeki,
+		s32 numKatu,
+		EMods mods,
+		const Beatmap& beatmap
+	)>;
+
+	struct Candidate
+	{
+		std::string Name;
+		EGamemode Mode;
+		factory_t Create;
+	};
+
+	static std::vector<std::string> CandidateNames(EGamemode mode);
+	static const Candidate& FindCandidate(EGamemode mode, const std::string& name);
+
+	template <class TScore>
+	static factory_t Factory()
+	{
+		return [](
+			s64 scoreId,
+			EGamemode mode,
+			s64 userId,
+			s32 beatmapId,
+			s32 score,
+			s32 maxCombo,
+			s32 num300,
+			s32 num100,
+			s32 num50,
+			s32 numMiss,
+			s32 numGeki,
+			s32 numKatu,
+			EMods mods,
+			const Beatmap& beatmap
+		) -> std::unique_ptr<Score>
+		{
+			return std::make_unique<TScore>(scoreId, mode, userId, beatmapId, score, maxCombo, num300, num100, num50, numMiss, numGeki, numKatu, mods, beatmap);
+		};
+	}
+
+private:
+	static const std::vector<Candidate>& candidates();
+};
+
+PP_NAMESPACE_END
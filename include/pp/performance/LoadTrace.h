@@ -0,0 +1,34 @@
+#pragma once
+
+#include <pp/Common.h>
+
+#include <pp/shared/DatabaseConnection.h>
+
+#include <atomic>
+#include <chrono>
+
+PP_NAMESPACE_BEGIN
+
+DEFINE_EXCEPTION(LoadTraceException);
+
+// Records when entries arrive at `score_process_queue`, together with the scores they refer to,
+// into a trace file of one JSON object per line. The trace can be replayed into a different
+// database while measuring how long a running `new` processor takes to handle each entry.
+class LoadTrace
+{
+public:
+	LoadTrace(EGamemode gamemode, std::string filename);
+
+	// Captures until the duration elapsed or shallStop is set. A duration of 0 captures until shallStop is set.
+	void Capture(DatabaseConnection& dbSource, std::chrono::seconds duration, std::chrono::milliseconds pollInterval, const std::atomic<bool>& shallStop);
+
+	// Replays at the given multiple of the captured speed, or as fast as possible if speed is 0.
+	// Processed entries are watched for through dbWatch, such that inserting is never held up by it.
+	void Replay(DatabaseConnection& dbTarget, DatabaseConnection& dbWatch, f64 speed, const std::atomic<bool>& shallStop);
+
+private:
+	EGamemode _gamemode;
+	std::string _filename;
+};
+
+PP_NAMESPACE_END
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <pp/Common.h>
+
+#include <pp/shared/PerfCounters.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+PP_NAMESPACE_BEGIN
+
+// Attributes the events counted by PerfCounters to the phases of processing users, separately for every thread.
+// Only a single profiler may be in use at a time.
+class PhaseProfiler
+{
+public:
+	enum class EPhase : u32
+	{
+		Fetch = 0, // Querying scores
+		Parse,     // Reading the returned rows
+		Compute,   // Looking up beatmaps and computing pp of scores
+		Aggregate, // Combining pp of scores into the ones of users
+		Write,     // Queueing the updates
+
+		NumPhases,
+	};
+
+	static const char* PhaseName(EPhase phase);
+
+	// Counts events of the calling thread towards a phase until destructed. Does nothing without a profiler.
+	class Scope
+	{
+	public:
+		Scope(PhaseProfiler* pProfiler, EPhase phase);
+		~Scope();
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+		// Ends the current phase and begins the given one
+		void Switch(EPhase phase);
+
+	private:
+		void begin();
+		void end();
+
+		PhaseProfiler* _pProfiler;
+		EPhase _phase;
+
+		PerfCounters::values_t _startValues;
+		std::chrono::steady_clock::time_point _startTime;
+	};
+
+	void AddScores(u64 numScores);
+
+	// Logs per phase IPC and events per score, as well as IPC of each thread
+	void LogReport() const;
+
+private:
+	static const size_t s_numPhases = (size_t)EPhase::NumPhases;
+
+	struct ThreadProfile
+	{
+		PerfCounters Counters;
+
+		std::array<std::array<std::atomic<u64>, PerfCounters::NumEvents>, s_numPhases> Events;
+		std::array<std::atomic<u64>, s_numPhases> Nanoseconds;
+		std::atomic<u64> NumScores;
+	};
+
+	// Registers the calling thread on its first call
+	ThreadProfile& threadProfile();
+
+	mutable std::mutex _mutex;
+	std::vector<std::unique_ptr<ThreadProfile>> _threadProfiles;
+};
+
+PP_NAMESPACE_END
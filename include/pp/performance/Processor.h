@@ -4,12 +4,22 @@
 
 #include <pp/performance/Beatmap.h>
 #include <pp/performance/CURL.h>
+#include <pp/performance/DatasetGenerator.h>
 #include <pp/performance/DDog.h>
+#include <pp/performance/FormulaComparison.h>
+#include <pp/performance/PhaseProfiler.h>
+#include <pp/performance/RankIndex.h>
 #include <pp/performance/User.h>
 
 #include <pp/shared/DatabaseConnection.h>
+#include <pp/shared/LRUCache.h>
+#include <pp/shared/Numa.h>
 #include <pp/shared/Threading.h>
+#include <pp/shared/UpdateBatch.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -21,20 +31,43 @@ DEFINE_EXCEPTION(ProcessorException);
 class Processor
 {
 public:
-	Processor(EGamemode gamemode, const std::string& configFile);
+	// With lazyBeatmaps set, only beatmaps that processed scores refer to are loaded. MonitorNewScores loads the rest on its own.
+	Processor(EGamemode gamemode, const std::string& configFile, bool lazyBeatmaps = false);
 	~Processor();
 
 	void MonitorNewScores();
 	void ProcessAllUsers(bool reProcess, u32 numThreads);
-	void ProcessUsers(const std::vector<std::string>& userNames);
-	void ProcessUsers(const std::vector<s64>& userIds);
-	void ProcessScores(const std::vector<s64>& scoreIds);
-	void ProcessSQL(u32 numThreads, std::string sql);
+	// Forks worker processes which share the beatmaps loaded by this processor, each opening its own connections and
+	// processing the users whose ID modulo numProcesses equals its index. Crashed workers are restarted from their own checkpoint.
+	void ProcessAllUsersInWorkers(bool reProcess, u32 numProcesses, u32 numThreads);
+	void ProcessUsers(const std::vector<std::string>& userNames, u32 numThreads);
+	void ProcessUsers(const std::vector<s64>& userIds, u32 numThreads);
+	void ProcessScores(const std::vector<s64>& scoreIds, u32 numThreads);
+	void ProcessSQL(bool reProcess, u32 numThreads, std::string sql);
+
+	// Records arrivals of new scores from the slave, and replays them into the master respectively
+	void CaptureLoad(const std::string& filename, u32 durationSeconds);
+	void ReplayLoad(const std::string& filename, f64 speed);
+
+	// Fills the master database with synthetic data. User metadata and pp column names are taken from the config.
+	void GenerateDataset(DatasetGenerator::Parameters parameters, u32 numThreads);
+
+	// Writes the global rank of every user with pp as CSV
+	void ExportRanks(const std::string& filename);
+
+	// Recomputes users with scores lacking pp, sweeping scores by ID from the last checkpoint
+	void BackfillNullPP(u32 numThreads);
+
+	// Fills the pp table with the pp of all ranked beatmaps on the configured grid of mods, accuracies and misses
+	void ComputePPTables(u32 numThreads);
 
 private:
 	static const Beatmap::ERankedStatus s_minRankedStatus;
 	static const Beatmap::ERankedStatus s_maxRankedStatus;
 
+	// Upper bound on the amount of IDs within a single `IN (...)` clause
+	static const size_t s_maxNumIdsPerQuery;
+
 	std::string lastScoreIdKey()
 	{
 		return StrFormat("pp_last_score_id{0}", GamemodeSuffix(_gamemode));
@@ -45,6 +78,22 @@ class Processor
 		return StrFormat("pp_last_user_id{0}", GamemodeSuffix(_gamemode));
 	}
 
+	std::string workerUserIdKey(u32 index, u32 numProcesses)
+	{
+		return StrFormat("{0}_{1}of{2}", lastUserIdKey(), index, numProcesses);
+	}
+
+	std::string backfillScoreIdKey()
+	{
+		return StrFormat("pp_backfill_score_id{0}", GamemodeSuffix(_gamemode));
+	}
+
+	// Users to whom it applies are stored with 0pp, and hence are unranked
+	static std::string inactiveOrRestrictedCondition(const std::string& lastPlayed, const std::string& userWarnings)
+	{
+		return StrFormat("(CURDATE() > DATE_ADD({0}, INTERVAL 3 MONTH) OR {1} > 0)", lastPlayed, userWarnings);
+	}
+
 	struct
 	{
 		std::string MySqlMasterHost;
@@ -81,21 +130,141 @@ class Processor
 
 		std::string DataDogHost;
 		s16 DataDogPort;
+
+		// Directory of the write-ahead journals. Journaling is disabled if empty.
+		std::string JournalPath;
+
+		// Fraction of all users above which the sql command scans scores by user ID ranges
+		f64 SQLRangeScanSelectivity;
+
+		// Comma-separated mod combinations (e.g. "NM,HD,HR,DT,HDDT") whose difficulty attributes
+		// are kept in RAM. All others are fetched on demand. Everything is resident if empty.
+		std::string ResidentMods;
+		s32 ColdCacheSize;
+
+		// When monitoring new scores, start right away and load beatmaps in the background, with
+		// the ones of incoming scores loaded on demand in the meantime
+		bool BackgroundWarmup;
+		s32 WarmupThreads;
+
+		// Column of `osu_beatmaps` which increases whenever a beatmap's status or attributes change, e.g. "last_update".
+		// Changed beatmaps are reloaded while monitoring new scores. Disabled if empty.
+		std::string BeatmapChangeColumn;
+
+		// Bulk output of the difficulty calculator to take attributes from on startup instead of the database.
+		// See AttributeImport for the supported formats.
+		std::string AttributesFile;
+
+		// Remove acknowledged entries of `score_process_queue` while monitoring new scores, optionally
+		// copying them into an archive table of the same layout first
+		bool QueueCompactionEnabled;
+		s32 QueueCompactionBatchSize;
+		// Milliseconds between batches
+		s32 QueueCompactionInterval;
+		// Seconds the slave may lag behind before compaction backs off
+		s32 QueueCompactionMaxReplicaLag;
+		std::string QueueCompactionArchiveTable;
+
+		// Backfill pp of scores lacking them alongside monitoring new scores, over and over again
+		bool BackfillEnabled;
+		s32 BackfillThreads;
+		// Score IDs swept between checkpoints
+		s64 BackfillRangeSize;
+		// Users recomputed per second. Unlimited if 0.
+		f64 BackfillRate;
+
+		// Comma-separated candidate formulas to compare with the current ones. Only pp of the current ones are stored.
+		std::string FormulaCandidates;
+		std::string FormulaComparisonFile;
+
+		// Count hardware events per phase of processing users, reported on shutdown
+		bool ProfilingEnabled;
+
+		// Pin each worker thread to a single core, distributed round-robin across NUMA nodes
+		bool PinThreads;
+		// Give every NUMA node its own copy of the beatmaps during full recalculations
+		bool ReplicateBeatmaps;
+
+		// Keep the global ranking in memory, e.g. for ranks of notable events
+		bool RankingEnabled;
+
+		// Keep pp tables of newly ranked beatmaps up to date while monitoring new scores
+		bool PPTablesEnabled;
+		std::string PPTablesTableName;
+		// Comma-separated mod combinations, accuracies in percent, and miss counts spanning the table grid
+		std::string PPTablesMods;
+		std::string PPTablesAccuracies;
+		std::string PPTablesMisses;
 	} _config;
 
 	void readConfig(const std::string& filename);
 
+	// Runs a step of the constructor and reports how long it took
+	void runStartupStage(std::string name, std::function<void()> stage);
+
+	// Statistics gathered while processing, logged on destruction or when a worker process exits
+	void logSummary() const;
+
 	std::shared_ptr<DatabaseConnection> newDBConnectionMaster();
 	std::shared_ptr<DatabaseConnection> newDBConnectionSlave();
 
+	// One connection pair and batch pair per thread. Journaled under the given name if it is not empty.
+	void openConnections(
+		u32 numThreads,
+		const std::string& journalName,
+		std::vector<std::shared_ptr<DatabaseConnection>>& dbConnections,
+		std::vector<std::shared_ptr<DatabaseConnection>>& dbSlaveConnections,
+		std::vector<UpdateBatch>& newUsersBatches,
+		std::vector<UpdateBatch>& newScoresBatches
+	);
+
+	NumaTopology _numaTopology;
+	std::function<void(u32)> workerInitializer() const;
+
+	void waitForTasks(ThreadPool& threadPool);
+
+	// Commits partially filled batches and blocks until the connections have no pending queries left
+	void flushUpdates(
+		std::vector<UpdateBatch>& newUsersBatches,
+		std::vector<UpdateBatch>& newScoresBatches,
+		const std::vector<std::shared_ptr<DatabaseConnection>>& dbConnections
+	);
+
+	void waitForPendingQueries(DatabaseConnection& db);
+
+	std::string journalFilename(const std::string& name) const;
+	void enableJournal(DatabaseConnection& db, const std::string& name);
+	void replayOrphanedJournals(const std::string& name, u32 firstIndex);
+
 	// Difficulty data is held in RAM.
 	// A few hundred megabytes.
 	// Stored inside a hashmap with the beatmap ID as key
 	std::unordered_map<s32, Beatmap> _beatmaps;
 	std::string _lastApprovedDate;
 
+	// Per NUMA node copies of _beatmaps, allocated by a thread on that node. Dropped whenever _beatmaps changes.
+	std::vector<std::unique_ptr<std::unordered_map<s32, Beatmap>>> _beatmapReplicas;
+	void replicateBeatmaps();
+	// The beatmaps closest to the calling thread. Requires holding _beatmapMutex.
+	const std::unordered_map<s32, Beatmap>& localBeatmaps() const;
+
+	// From the database, or from the attributes file if configured
+	void loadAllBeatmaps(u32 numThreads);
 	void queryAllBeatmapDifficulties(u32 numThreads);
+	void importAllBeatmapDifficulties(u32 numThreads);
 	bool queryBeatmapDifficulty(DatabaseConnection& dbSlave, s32 startId, s32 endId = 0);
+	bool queryBeatmapDifficulties(DatabaseConnection& dbSlave, const std::string& condition);
+
+	// Beatmaps matching the condition, without touching the ones in use
+	std::unordered_map<s32, Beatmap> loadBeatmaps(DatabaseConnection& dbSlave, const std::string& condition);
+	// Replaces the beatmap with the same ID. Requires holding _beatmapMutex for writing.
+	void publishBeatmap(Beatmap beatmap);
+
+	std::string _lastBeatmapChange;
+	// Already refreshed beatmaps whose change column equals _lastBeatmapChange
+	std::unordered_set<s32> _lastBeatmapChangeIds;
+	void pollAndRefreshChangedBeatmaps(DatabaseConnection& dbSlave);
+	void refreshBeatmaps(DatabaseConnection& dbSlave, const std::vector<s32>& beatmapIds);
 
 	std::shared_ptr<DatabaseConnection> _pDB;
 	std::shared_ptr<DatabaseConnection> _pDBSlave;
@@ -109,12 +278,87 @@ class Processor
 	void pollAndProcessNewScores();
 	void pollAndProcessNewBeatmapSets(DatabaseConnection& dbSlave);
 
+	// Queue ID of the last stored checkpoint, whose write may still be pending
+	s64 _checkpointedQueueId = 0;
+	// Commits the last checkpoint once it is known to be written to the master. Returns the number of pending queries.
+	size_t commitQueueCheckpointIfWritten();
+
+	// Queue ID up to which processing was checkpointed
+	std::atomic<s64> _committedQueueId{0};
+	void compactQueue();
+	// In seconds, 0 if the slave isn't a replica, or -1 if replication is stopped. Throws if the status can't be retrieved.
+	s64 replicaLag(DatabaseConnection& dbSlave);
+
 	std::unordered_set<s32> _blacklistedBeatmapIds;
-	void queryBeatmapBlacklist();
+	void queryBeatmapBlacklist(DatabaseConnection& dbSlave);
 
 	std::vector<Beatmap::EDifficultyAttributeType> _difficultyAttributes;
 	void queryBeatmapDifficultyAttributes();
 
+	// Relevant difficulty mods whose attributes are held by _beatmaps. All of them if empty.
+	std::unordered_set<u32> _residentMods;
+	std::string residentModsCondition() const;
+
+	struct ColdDifficulty
+	{
+		bool Found;
+		Beatmap::attributes_t Attributes;
+	};
+
+	// Attributes of non-resident mod combinations, keyed by beatmap ID in the upper and relevant mods in the lower 32 bits
+	std::unique_ptr<LRUCache<u64, ColdDifficulty>> _pColdDifficulties;
+	// Releases the given lock on _beatmapMutex, if any, while querying the database
+	bool queryColdDifficulty(DatabaseConnection& dbSlave, const Beatmap& beatmap, EMods mods, Beatmap::attributes_t& attributes, RWLock* pLock);
+
+	// The given beatmap if its attributes for mods are resident, and otherwise coldBeatmap with them filled in if they exist.
+	// Beatmaps referred to before the call are invalid afterwards if a lock is given, since it may have been released.
+	const Beatmap& beatmapWithDifficulty(DatabaseConnection& dbSlave, const Beatmap& beatmap, EMods mods, Beatmap& coldBeatmap, RWLock* pLock);
+
+	std::vector<EMods> _ppTableMods;
+	std::vector<f64> _ppTableAccuracies;
+	std::vector<s32> _ppTableMisses;
+	void createPPTable(DatabaseConnection& db);
+
+	// Must be called without holding _beatmapMutex, which it acquires itself
+	void computePPTable(DatabaseConnection& dbSlave, UpdateBatch& ppTables, s32 beatmapId);
+
+	template <class TScore>
+	void computePPTableGeneric(DatabaseConnection& dbSlave, UpdateBatch& ppTables, const Beatmap& beatmap);
+
+	// The columns of `osu_scores_high` that pp are computed from
+	struct ScoreRow
+	{
+		s64 ScoreId;
+		s64 UserId;
+		s32 BeatmapId;
+		s32 Score;
+		s32 MaxCombo;
+		s32 Num300;
+		s32 Num100;
+		s32 Num50;
+		s32 NumMiss;
+		s32 NumGeki;
+		s32 NumKatu;
+		EMods Mods;
+
+		bool HasPP;
+		f32 PP;
+
+		// Whether the user of the score is inactive or restricted, and hence stored with 0pp
+		bool IsUserUnranked;
+	};
+
+	// Scores matching the given WHERE condition, grouped by user ID. The condition may only refer to `user_id` unqualified.
+	std::unordered_map<s64, std::vector<ScoreRow>> queryScores(DatabaseConnection& dbSlave, const std::string& condition);
+
+	std::atomic<bool> _lazyBeatmaps;
+	std::unordered_set<s32> _unavailableBeatmapIds;
+	void queryMissingBeatmapDifficulties(DatabaseConnection& dbSlave, const std::vector<ScoreRow>& scores);
+
+	// Held with high priority while loading beatmaps on demand. The warmup passes it with low priority
+	// before each chunk, such that scores waiting for their beatmaps go first.
+	PriorityMutex _beatmapLoadMutex;
+
 	// Not thread safe with beatmap data!
 	User processSingleUser(
 		s64 selectedScoreId, // If this is not 0, then the score is looked at in isolation, triggering a notable event if it's good enough
@@ -125,6 +369,17 @@ class Processor
 		s64 userId
 	);
 
+	// Same as above, but with the scores of the user already retrieved
+	User processSingleUser(
+		s64 selectedScoreId,
+		DatabaseConnection& db,
+		DatabaseConnection& dbSlave,
+		UpdateBatch& newUsers,
+		UpdateBatch& newScores,
+		s64 userId,
+		const std::vector<ScoreRow>& scores
+	);
+
 	template <class TScore>
 	User processSingleUserGeneric(
 		s64 selectedScoreId, // If this is not 0, then the score is looked at in isolation, triggering a notable event if it's good enough
@@ -132,22 +387,68 @@ class Processor
 		DatabaseConnection& dbSlave,
 		UpdateBatch& newUsers,
 		UpdateBatch& newScores,
-		s64 userId
+		s64 userId,
+		const std::vector<ScoreRow>& scores
 	);
 
+	std::unique_ptr<FormulaComparison> _pFormulaComparison;
+	std::unique_ptr<PhaseProfiler> _pProfiler;
+
+	// Users with IDs above the checkpoint matching the partition condition, e.g. " AND `user_id`%4=1"
+	void processAllUsers(bool reProcess, u32 numThreads, const std::string& journalName, const std::string& checkpointKey, const std::string& partitionCondition);
+
+#ifndef _WIN32
+	// Body of a forked worker process. Never returns.
+	[[noreturn]] void runWorker(u32 index, u32 numProcesses, u32 numThreads, u32 numRestarts);
+#endif
+
+	// No connection or thread may exist while forking, since only the forking thread is carried over into the child
+	void disconnect();
+	void reconnect();
+
+	// Without wrapping around, stops once the newest score is reached. Wrapping around is meant to run
+	// alongside monitoring new scores, in which case users are written one by one while locked.
+	void backfillNullPP(u32 numThreads, bool wrapAround);
+
+	// Keeps the score thread and the backfill from recomputing the same user at once. The backfill writes
+	// before unlocking, such that its total can't overwrite a fresher one of the score thread.
+	class UserLock
+	{
+	public:
+		UserLock(Processor* pProcessor, s64 userId);
+		~UserLock();
+
+		UserLock(const UserLock&) = delete;
+		UserLock& operator=(const UserLock&) = delete;
+
+	private:
+		Processor* _pProcessor;
+		s64 _userId;
+	};
+
+	std::mutex _lockedUserIdsMutex;
+	std::condition_variable _lockedUserIdsCondition;
+	std::unordered_set<s64> _lockedUserIds;
+
+	std::unique_ptr<RankIndex> _pRankIndex;
+	void buildRankIndex(u32 numThreads);
+
 	void storeCount(DatabaseConnection& db, std::string key, s64 value);
 	s64 retrieveCount(DatabaseConnection& db, std::string key);
 
-	std::string retrieveUserName(s64 userId, DatabaseConnection& db) const;
-	std::string retrieveBeatmapName(s32 beatmapId, DatabaseConnection& db) const;
+	std::unordered_map<s64, std::string> retrieveUserNames(const std::vector<s64>& userIds, DatabaseConnection& db) const;
+	std::unordered_map<s32, std::string> retrieveBeatmapNames(const std::vector<s32>& beatmapIds, DatabaseConnection& db) const;
 
 	EGamemode _gamemode;
 	bool _isDocker = false;
 
 	RWMutex _beatmapMutex;
-	bool _shallShutdown = false;
 
-	CURL _curl;
+	// Set by SIGINT and SIGTERM. Processing stops taking new work and drains what is in flight.
+	static std::atomic<bool> s_shallShutdown;
+	static void onShutdownSignal(int signal);
+
+	std::unique_ptr<CURL> _pCurl;
 	std::unique_ptr<DDog> _pDataDog;
 };
 
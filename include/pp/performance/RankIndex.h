@@ -0,0 +1,46 @@
+#pragma once
+
+#include <pp/Common.h>
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+PP_NAMESPACE_BEGIN
+
+// Global ranking of all users of a game mode by their pp. Users are counted per 0.01pp bucket
+// in a Fenwick tree, such that updates and rank queries take O(log n) time. Users within the
+// same bucket share their rank.
+class RankIndex
+{
+public:
+	RankIndex();
+
+	// Users with 0 pp are unranked and thus removed. Unless insertIfMissing is set, only users already ranked are updated.
+	void Update(s64 userId, f64 pp, bool insertIfMissing = true);
+
+	// Starting at 1. Unranked users have rank 0.
+	s64 Rank(s64 userId) const;
+
+	size_t NumUsers() const;
+
+	// All ranked users, best first
+	std::vector<std::pair<s64, s64>> Ranks() const;
+
+private:
+	static const f64 s_maxPP;
+	static const f64 s_bucketsPerPP;
+
+	static u32 bucket(f64 pp);
+
+	void add(u32 bucket, s32 delta);
+	s64 numAtOrBelow(u32 bucket) const;
+
+	std::vector<u32> _tree;
+	s64 _numUsers = 0;
+
+	std::unordered_map<s64, u32> _userBuckets;
+	mutable std::mutex _mutex;
+};
+
+PP_NAMESPACE_END
@@ -34,6 +34,9 @@ class Score
 		EMods mods
 	);
 
+	// Candidate formulas are owned through pointers to this base class
+	virtual ~Score() = default;
+
 	s64 Id() const { return _scoreId; }
 	s64 UserId() const { return _userId; }
 	s32 BeatmapId() const { return _beatmapId; }
@@ -33,6 +33,9 @@ class Active
 
 	SharedQueue<std::function<void()>> _tasks;
 
+	// Unlike the size of _tasks, this includes the task being executed
+	std::atomic<size_t> _numPending{0};
+
 	std::thread _thread;
 	std::atomic<bool> _isDone;
 
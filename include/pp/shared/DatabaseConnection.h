@@ -2,13 +2,32 @@
 
 #include <pp/Common.h>
 #include <pp/shared/Active.h>
+#include <pp/shared/Journal.h>
 #include <pp/shared/QueryResult.h>
 
 #include <mysql.h>
 
 PP_NAMESPACE_BEGIN
 
-DEFINE_EXCEPTION(DatabaseException);
+class DatabaseException : public Exception
+{
+public:
+	DatabaseException(const std::string& file, s32 line, const std::string& description, u32 errorCode = 0)
+	: Exception{file, line, description}, _errorCode{errorCode} { Log(); }
+
+	// The MySQL error number, or 0 if the error did not come from MySQL
+	u32 ErrorCode() const { return _errorCode; }
+
+	// Whether the same query may succeed when retried, e.g. after losing the connection, a failover or a deadlock.
+	// Only errors of the query itself, such as syntax errors or duplicate keys, are permanent.
+	bool IsTransient() const;
+
+	// Whether the user lacks a privilege required by the query, such that retrying is futile
+	bool IsAccessDenied() const;
+
+private:
+	u32 _errorCode;
+};
 
 class DatabaseConnection
 {
@@ -29,22 +48,36 @@ class DatabaseConnection
 
 	~DatabaseConnection();
 
+	// Routes all subsequent background queries through an on-disk journal.
+	// They no longer block when the database is slow or unavailable.
+	void EnableJournal(const std::string& filename, const std::string& markerKey);
+
 	void NonQueryBackground(const std::string& queryString);
 	void NonQuery(const std::string& queryString);
 	QueryResult Query(const std::string& queryString);
 
+	// Rows are transferred from the server while iterating over the result rather than all at once.
+	// The connection must not be used for anything else until the result was fully read.
+	QueryResult QueryStreaming(const std::string& queryString);
+
+	// Escapes special characters such that the result can be placed within quotes inside a query
+	std::string Escape(const std::string& str);
+
 	//returns error messages
 	const char* Error();
 
 	//returns the number of rows e.g. returned by a SELECT
 	u32 AffectedRows();
 
-	size_t NumPendingQueries() const { return _pActive->NumPending(); }
+	size_t NumPendingQueries() const;
+
+	void Reconnect();
 
 private:
 	void connect();
 
 	std::unique_ptr<Active> _pActive;
+	std::unique_ptr<Journal> _pJournal;
 	std::recursive_mutex _dbMutex;
 
 	std::string _host;
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <pp/Common.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+PP_NAMESPACE_BEGIN
+
+DEFINE_EXCEPTION(JournalException);
+
+class DatabaseConnection;
+
+// Append-only on-disk log of the background writes of a single database connection.
+// Appending never waits for the database. A background thread replays the records
+// in order and commits each of them together with its sequence number into `osu_counts`,
+// such that every record is applied exactly once, even across restarts.
+class Journal
+{
+public:
+	Journal(DatabaseConnection& db, std::string filename, std::string markerKey);
+	~Journal();
+
+	Journal(const Journal&) = delete;
+	Journal& operator=(const Journal&) = delete;
+
+	// Returns once the record is on disk. This costs a disk flush per background write, most of which
+	// are whole UpdateBatches rather than single updates.
+	void Append(const std::string& queryString);
+
+	// Throws once replaying failed for good, as the pending records would never be replayed
+	size_t NumPending();
+
+private:
+	struct Record
+	{
+		u64 Sequence;
+		std::string Query;
+	};
+
+	void run();
+	void replayAll();
+
+	void recover();
+	bool readRecord(FILE* pFile, Record& record);
+	void replay(const Record& record);
+
+	// Records failing with a permanent error are written there instead of being retried forever
+	std::string deadLetterFilename() const;
+	void writeDeadLetter(const Record& record, const std::string& error);
+	void truncateIfDrained();
+
+	s64 retrieveMarker();
+
+	DatabaseConnection& _db;
+
+	std::string _filename;
+	std::string _markerKey;
+
+	FILE* _pWriteFile = nullptr;
+	FILE* _pReadFile = nullptr;
+
+	// Byte offsets into the journal file. Everything before _writeOffset is fully written,
+	// everything before _readOffset has been replayed.
+	s64 _writeOffset = 0;
+	s64 _readOffset = 0;
+
+	u64 _nextSequence = 1;
+	s64 _marker = 0;
+
+	std::atomic<size_t> _numPending{0};
+	std::atomic<bool> _shallShutdown{false};
+
+	std::mutex _mutex;
+	std::condition_variable _recordCondition;
+
+	std::exception_ptr _journalException = nullptr;
+
+	std::thread _thread;
+};
+
+PP_NAMESPACE_END
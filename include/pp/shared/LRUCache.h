@@ -0,0 +1,91 @@
+#pragma once
+
+#include <pp/Common.h>
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+PP_NAMESPACE_BEGIN
+
+// Thread-safe cache holding up to a fixed amount of entries.
+// The least recently used entry is evicted first.
+template <typename K, typename V>
+class LRUCache
+{
+public:
+	LRUCache(size_t capacity) : _capacity{capacity} {}
+
+	bool TryGet(const K& key, V& value)
+	{
+		std::lock_guard<std::mutex> lock{_mutex};
+
+		auto it = _index.find(key);
+		if (it == std::end(_index))
+		{
+			++_numMisses;
+			return false;
+		}
+
+		// Move to the front to mark as most recently used
+		_entries.splice(std::begin(_entries), _entries, it->second);
+		value = it->second->second;
+
+		++_numHits;
+		return true;
+	}
+
+	void Put(const K& key, V value)
+	{
+		std::lock_guard<std::mutex> lock{_mutex};
+
+		auto it = _index.find(key);
+		if (it != std::end(_index))
+		{
+			it->second->second = std::move(value);
+			_entries.splice(std::begin(_entries), _entries, it->second);
+			return;
+		}
+
+		_entries.emplace_front(key, std::move(value));
+		_index[key] = std::begin(_entries);
+
+		if (_entries.size() > _capacity)
+		{
+			_index.erase(_entries.back().first);
+			_entries.pop_back();
+		}
+	}
+
+	void Clear()
+	{
+		std::lock_guard<std::mutex> lock{_mutex};
+
+		_entries.clear();
+		_index.clear();
+	}
+
+	size_t Size() const
+	{
+		std::lock_guard<std::mutex> lock{_mutex};
+		return _entries.size();
+	}
+
+	u64 NumHits() const { return _numHits; }
+	u64 NumMisses() const { return _numMisses; }
+
+private:
+	using entries_t = std::list<std::pair<K, V>>;
+
+	size_t _capacity;
+
+	entries_t _entries;
+	std::unordered_map<K, typename entries_t::iterator> _index;
+	mutable std::mutex _mutex;
+
+	std::atomic<u64> _numHits{0};
+	std::atomic<u64> _numMisses{0};
+};
+
+PP_NAMESPACE_END
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <pp/Common.h>
+
+#include <vector>
+
+PP_NAMESPACE_BEGIN
+
+// The CPUs of each NUMA node of this machine. Systems without NUMA information
+// are treated as a single node containing all CPUs.
+class NumaTopology
+{
+public:
+	static NumaTopology Detect();
+
+	size_t NumNodes() const { return _nodeCpus.size(); }
+	const std::vector<u32>& NodeCpus(size_t node) const { return _nodeCpus.at(node); }
+
+	// Distributes workers round-robin across nodes, such that each node receives its share of the workers
+	u32 CpuOfWorker(u32 worker) const;
+	u32 NodeOfWorker(u32 worker) const;
+
+private:
+	std::vector<std::vector<u32>> _nodeCpus;
+};
+
+// Restricts the calling thread to the given CPUs. Returns false if this is not supported.
+bool PinCurrentThread(const std::vector<u32>& cpus);
+
+// The NUMA node the calling thread was pinned to, or -1 if it is not pinned.
+s32 CurrentNumaNode();
+void SetCurrentNumaNode(s32 node);
+
+PP_NAMESPACE_END
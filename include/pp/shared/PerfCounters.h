@@ -0,0 +1,55 @@
+#pragma once
+
+#include <pp/Common.h>
+
+#include <array>
+
+PP_NAMESPACE_BEGIN
+
+// Counts events of the calling thread via perf_event_open. Hardware events are unavailable e.g. within
+// virtual machines or with a restrictive perf_event_paranoid, in which case only the software events count.
+// Nothing counts on systems other than Linux.
+class PerfCounters
+{
+public:
+	enum EEvent : u32
+	{
+		Cycles = 0,
+		Instructions,
+		CacheMisses,
+		TLBMisses,
+		BranchMisses,
+
+		TaskClock, // In nanoseconds
+		PageFaults,
+		ContextSwitches,
+
+		NumEvents,
+	};
+
+	using values_t = std::array<u64, NumEvents>;
+
+	static const char* EventName(EEvent event);
+
+	PerfCounters();
+	~PerfCounters();
+
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+
+	bool IsAvailable(EEvent event) const { return _groupIndices[event] >= 0; }
+	bool HasHardwareEvents() const { return IsAvailable(Cycles) && IsAvailable(Instructions); }
+
+	// Counts since the construction, scaled up if the events had to share the hardware counters. Unavailable events read as 0.
+	values_t Read() const;
+
+private:
+	void open(EEvent event, u32 type, u64 config);
+
+	s32 _groupFd = -1;
+	u32 _numOpen = 0;
+	std::array<s32, NumEvents> _fds;
+	std::array<s32, NumEvents> _groupIndices;
+};
+
+PP_NAMESPACE_END
@@ -13,8 +13,10 @@ class QueryResult
 public:
 	bool NextRow();
 
+	// Only correct after all rows were read for streaming results
 	inline s32 NumRows() { return (s32)mysql_num_rows(_pRes.get()); }
 	inline s32 NumCols() { return (s32)mysql_num_fields(_pRes.get()); }
+	inline std::string ColumnName(size_t i) { return mysql_fetch_field_direct(_pRes.get(), (unsigned int)i)->name; }
 
 	// Entire current row - array of zero terminated strings
 	inline char** CurrentRow() { return _row; }
@@ -6,6 +6,7 @@
 #include <atomic>
 #include <condition_variable>
 #include <deque>
+#include <functional>
 #include <future>
 #include <mutex>
 #include <thread>
@@ -129,6 +130,8 @@ class ThreadPool
 public:
 	ThreadPool();
 	ThreadPool(const u32 numThreads);
+	// The initializer is run by every worker thread with its index before it starts processing tasks
+	ThreadPool(const u32 numThreads, std::function<void(u32)> threadInitializer);
 	~ThreadPool();
 
 	template<class F, class... Args>
@@ -171,6 +174,7 @@ class ThreadPool
 private:
 	u32 _numThreads = 0; // We don't have any threads running on startup
 	std::vector<std::thread> _threads;
+	std::function<void(u32)> _threadInitializer;
 
 	std::deque<std::function<void()>> _taskQueue;
 	std::mutex _taskQueueMutex;
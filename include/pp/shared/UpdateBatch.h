@@ -20,6 +20,9 @@ class UpdateBatch
 	void AppendAndCommit(const std::string& values);
 	void AppendAndCommitNonThreadsafe(const std::string& values);
 
+	// Commits whatever is left in the batch, regardless of the size threshold
+	void Flush();
+
 	std::mutex& Mutex() { return _batchMutex; }
 
 private:
@@ -1,6 +1,7 @@
 #include <pp/Common.h>
 
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 PP_NAMESPACE_BEGIN
@@ -104,6 +105,59 @@ std::string ToString(EMods mods)
 	return Join(modStrings, ",");
 }
 
+EMods ToMods(std::string modsString)
+{
+	static const std::unordered_map<std::string, u32> s_mods{
+		{"NF", NoFail},
+		{"EZ", Easy},
+		{"TD", TouchDevice},
+		{"HD", Hidden},
+		{"HR", HardRock},
+		{"SD", SuddenDeath},
+		{"DT", DoubleTime},
+		{"RX", Relax},
+		{"HT", HalfTime},
+		{"NC", Nightcore | DoubleTime},
+		{"FL", Flashlight},
+		{"SO", SpunOut},
+		{"AP", Relax2},
+		{"PF", Perfect | SuddenDeath},
+		{"FI", FadeIn},
+		{"K1", Key1},
+		{"K2", Key2},
+		{"K3", Key3},
+		{"K4", Key4},
+		{"K5", Key5},
+		{"K6", Key6},
+		{"K7", Key7},
+		{"K8", Key8},
+		{"K9", Key9},
+	};
+
+	modsString = ToUpper(modsString);
+	if (modsString == "NM" || modsString == "NONE")
+		return Nomod;
+
+	u32 result = Nomod;
+	for (size_t i = 0; i < modsString.size(); i += 2)
+	{
+		if (modsString.compare(i, 3, "K10") == 0)
+		{
+			result |= Key10;
+			++i;
+			continue;
+		}
+
+		auto modIt = s_mods.find(modsString.substr(i, 2));
+		if (modIt == std::end(s_mods))
+			throw Exception{SRC_POS, StrFormat("Invalid mods '{0}'", modsString)};
+
+		result |= modIt->second;
+	}
+
+	return static_cast<EMods>(result);
+}
+
 std::string GamemodeSuffix(EGamemode gamemode)
 {
 	switch (gamemode)
@@ -0,0 +1,214 @@
+#include <pp/Common.h>
+#include <pp/performance/AttributeImport.h>
+
+#include <nlohmann/json.hpp>
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+using json = nlohmann::json;
+
+PP_NAMESPACE_BEGIN
+
+namespace
+{
+	const std::string s_binaryMagic = "ppattrs1";
+
+	using entries_t = std::vector<AttributeImport::Entry>;
+
+	// Each thread fills its own entries, which are concatenated afterwards
+	entries_t parseInParallel(u32 numThreads, const std::function<void(u32, entries_t&)>& parse)
+	{
+		std::vector<entries_t> results(numThreads);
+		std::vector<std::exception_ptr> exceptions(numThreads);
+		std::vector<std::thread> threads;
+
+		for (u32 i = 0; i < numThreads; ++i)
+		{
+			threads.emplace_back([&, i]()
+			{
+				try
+				{
+					parse(i, results[i]);
+				}
+				catch (...)
+				{
+					exceptions[i] = std::current_exception();
+				}
+			});
+		}
+
+		for (auto& thread : threads)
+			thread.join();
+
+		for (const auto& exception : exceptions)
+			if (exception)
+				std::rethrow_exception(exception);
+
+		size_t numEntries = 0;
+		for (const auto& result : results)
+			numEntries += result.size();
+
+		entries_t entries;
+		entries.reserve(numEntries);
+
+		for (auto& result : results)
+			entries.insert(std::end(entries), std::begin(result), std::end(result));
+
+		return entries;
+	}
+
+	u32 readU32(const std::string& data, size_t offset)
+	{
+		u32 value;
+		std::memcpy(&value, data.data() + offset, sizeof(value));
+		return value;
+	}
+}
+
+AttributeImport::AttributeImport(EGamemode gamemode, std::string filename)
+: _gamemode{gamemode}, _filename{std::move(filename)}
+{
+}
+
+std::vector<AttributeImport::Entry> AttributeImport::Read(const std::vector<Beatmap::EDifficultyAttributeType>& attributeTypes, u32 numThreads)
+{
+	std::string data;
+
+	{
+		std::ifstream file{_filename, std::ios::binary | std::ios::ate};
+		if (!file)
+			throw AttributeImportException{SRC_POS, StrFormat("Could not open attributes '{0}' for reading.", _filename)};
+
+		data.resize((size_t)file.tellg());
+		file.seekg(0);
+
+		if (!file.read(&data[0], data.size()))
+			throw AttributeImportException{SRC_POS, StrFormat("Could not read attributes '{0}'.", _filename)};
+	}
+
+	numThreads = std::max(numThreads, 1u);
+
+	if (data.compare(0, s_binaryMagic.size(), s_binaryMagic) == 0)
+		return readBinary(data, attributeTypes, numThreads);
+
+	return readJson(data, attributeTypes, numThreads);
+}
+
+std::vector<AttributeImport::Entry> AttributeImport::readJson(const std::string& data, const std::vector<Beatmap::EDifficultyAttributeType>& attributeTypes, u32 numThreads)
+{
+	// Every thread takes the lines starting within its share of the bytes
+	auto lineStart = [&data](size_t position)
+	{
+		if (position == 0)
+			return (size_t)0;
+
+		size_t newline = data.find('\n', position - 1);
+		return newline == std::string::npos ? data.size() : newline + 1;
+	};
+
+	return parseInParallel(numThreads, [&](u32 thread, entries_t& entries)
+	{
+		size_t begin = lineStart(data.size() * thread / numThreads);
+		size_t end = lineStart(data.size() * (thread + 1) / numThreads);
+
+		while (begin < end)
+		{
+			size_t lineEnd = std::min(data.find('\n', begin), end);
+
+			const char* pLine = data.data() + begin;
+			size_t lineLength = lineEnd - begin;
+			size_t lineOffset = begin;
+
+			begin = lineEnd + 1;
+
+			if (lineLength == 0 || (lineLength == 1 && pLine[0] == '\r'))
+				continue;
+
+			try
+			{
+				json line = json::parse(pLine, pLine + lineLength);
+
+				if (line.at("mode").get<s32>() != (s32)_gamemode)
+					continue;
+
+				Entry entry{line.at("beatmap_id").get<s32>(), (EMods)line.at("mods").get<u32>(), {}};
+
+				const auto& attributes = line.at("attributes");
+				for (auto it = attributes.begin(); it != attributes.end(); ++it)
+				{
+					u32 id = (u32)std::stoul(it.key());
+					if (id < attributeTypes.size())
+						entry.Attributes[attributeTypes[id]] = it.value().get<f32>();
+				}
+
+				entries.emplace_back(entry);
+			}
+			catch (const std::exception& e)
+			{
+				throw AttributeImportException{SRC_POS, StrFormat("Invalid attributes in '{0}' at byte {1}: {2}", _filename, lineOffset, e.what())};
+			}
+		}
+	});
+}
+
+std::vector<AttributeImport::Entry> AttributeImport::readBinary(const std::string& data, const std::vector<Beatmap::EDifficultyAttributeType>& attributeTypes, u32 numThreads)
+{
+	size_t headerSize = s_binaryMagic.size() + 2 * sizeof(u32);
+	if (data.size() < headerSize)
+		throw AttributeImportException{SRC_POS, StrFormat("Attributes '{0}' are truncated.", _filename)};
+
+	s32 mode = (s32)readU32(data, s_binaryMagic.size());
+	u32 numAttributes = readU32(data, s_binaryMagic.size() + sizeof(u32));
+
+	if (mode != (s32)_gamemode)
+		throw AttributeImportException{SRC_POS, StrFormat("Attributes '{0}' are of mode {1} instead of {2}.", _filename, mode, (s32)_gamemode)};
+
+	// Before allocating anything, as a corrupt count could be arbitrarily large
+	if ((data.size() - headerSize) / sizeof(u32) < numAttributes)
+		throw AttributeImportException{SRC_POS, StrFormat("Attributes '{0}' are truncated.", _filename)};
+
+	std::vector<u32> ids(numAttributes);
+	for (u32 i = 0; i < numAttributes; ++i)
+		ids[i] = readU32(data, headerSize + i * sizeof(u32));
+
+	headerSize += numAttributes * sizeof(u32);
+	size_t recordSize = sizeof(s32) + sizeof(u32) + numAttributes * sizeof(f32);
+
+	if ((data.size() - headerSize) % recordSize != 0)
+		throw AttributeImportException{SRC_POS, StrFormat("Attributes '{0}' are truncated.", _filename)};
+
+	size_t numRecords = (data.size() - headerSize) / recordSize;
+
+	return parseInParallel(numThreads, [&](u32 thread, entries_t& entries)
+	{
+		size_t begin = numRecords * thread / numThreads;
+		size_t end = numRecords * (thread + 1) / numThreads;
+
+		entries.reserve(end - begin);
+
+		for (size_t i = begin; i < end; ++i)
+		{
+			size_t offset = headerSize + i * recordSize;
+
+			Entry entry{(s32)readU32(data, offset), (EMods)readU32(data, offset + sizeof(s32)), {}};
+			offset += sizeof(s32) + sizeof(u32);
+
+			for (u32 j = 0; j < numAttributes; ++j)
+			{
+				f32 value;
+				std::memcpy(&value, data.data() + offset + j * sizeof(f32), sizeof(value));
+
+				if (!std::isnan(value) && ids[j] < attributeTypes.size())
+					entry.Attributes[attributeTypes[ids[j]]] = value;
+			}
+
+			entries.emplace_back(entry);
+		}
+	});
+}
+
+PP_NAMESPACE_END
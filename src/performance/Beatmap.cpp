@@ -28,9 +28,31 @@ f32 Beatmap::DifficultyAttribute(EMods mods, EDifficultyAttributeType type) cons
 	return difficultyIt == std::end(_difficulty) ? 0.0f : difficultyIt->second[type];
 }
 
+bool Beatmap::HasDifficulty(EMods mods) const
+{
+	return _difficulty.count(MaskRelevantDifficultyMods(_mode, mods)) > 0;
+}
+
+Beatmap Beatmap::WithoutDifficulty() const
+{
+	Beatmap beatmap{_id};
+	beatmap._mode = _mode;
+	beatmap._rankedStatus = _rankedStatus;
+	beatmap._scoreVersion = _scoreVersion;
+	beatmap._numHitCircles = _numHitCircles;
+	beatmap._numSliders = _numSliders;
+	beatmap._numSpinners = _numSpinners;
+	return beatmap;
+}
+
 void Beatmap::SetDifficultyAttribute(EMods mods, EDifficultyAttributeType type, f32 value)
 {
 	_difficulty[MaskRelevantDifficultyMods(_mode, mods)][type] = value;
 }
 
+void Beatmap::SetDifficultyAttributes(EMods mods, const attributes_t& attributes)
+{
+	_difficulty[MaskRelevantDifficultyMods(_mode, mods)] = attributes;
+}
+
 PP_NAMESPACE_END
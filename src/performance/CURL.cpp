@@ -4,18 +4,61 @@
 
 #include <curl/curl.h>
 
+#include <algorithm>
+
+using namespace std::chrono;
+
 PP_NAMESPACE_BEGIN
 
+namespace
+{
+	// Further notifications are dropped while this many are waiting
+	const size_t s_maxQueueSize = 1000;
+
+	const size_t s_maxNumTransfers = 8;
+
+	// At most this many requests in a burst, refilled at the given rate
+	const f64 s_maxNumTokens = 10;
+	const f64 s_tokensPerSecond = 1;
+
+	// Repeats of a notification within this window are only counted and reported once it expires
+	const seconds s_coalescingWindow{60};
+
+	// Pending notifications are given up on once shutting down takes longer than this
+	const seconds s_maxShutdownDuration{5};
+
+	const milliseconds s_pollInterval{100};
+}
+
 size_t EmptyCURLWriteData(void *buffer, size_t size, size_t nmemb, void *userp)
 {
 	return size * nmemb;
 }
 
 CURL::CURL()
-: _pCURL{curl_easy_init(), &curl_easy_cleanup}
+: _pMulti{curl_multi_init(), &curl_multi_cleanup}, _numTokens{s_maxNumTokens}, _lastRefillTime{steady_clock::now()}
 {
-	curl_easy_setopt(_pCURL.get(), CURLOPT_SSL_VERIFYPEER, false);
-	curl_easy_setopt(_pCURL.get(), CURLOPT_WRITEFUNCTION, EmptyCURLWriteData);
+	_thread = std::thread(&CURL::run, this);
+}
+
+CURL::~CURL()
+{
+	{
+		std::lock_guard<std::mutex> lock{_queueMutex};
+		_shallShutdown = true;
+	}
+
+	_queueCondition.notify_one();
+
+	if (_thread.joinable())
+		_thread.join();
+
+	for (auto& transfer : _transfers)
+	{
+		curl_multi_remove_handle(_pMulti.get(), transfer.first);
+		curl_easy_cleanup(transfer.first);
+		curl_slist_free_all(transfer.second.pHeaders);
+	}
 }
 
 void CURL::SendToSlack(
@@ -26,54 +69,35 @@ void CURL::SendToSlack(
 	std::string channel,
 	std::string message)
 {
-	std::string url = StrFormat(
-		"https://{0}/services/hooks/incoming-webhook?token={1}", domain, key
-	);
-
-	curl_easy_setopt(_pCURL.get(), CURLOPT_URL, url.c_str());
-
-	std::string postData = StrFormat(
-		R"(
-			{{
-				"channel":"{0}",
-				"username":"{1}",
-				"icon_url":"{2}",
-				"text":"{3}"
-			}
-		)",
-		channel, username, iconURL, message
-	);
-
-	curl_easy_setopt(_pCURL.get(), CURLOPT_CUSTOMREQUEST, "POST");
-	curl_easy_setopt(_pCURL.get(), CURLOPT_POSTFIELDS, postData.c_str());
-
-	struct curl_slist* headers = nullptr;
-	headers = curl_slist_append(headers, "Content-Type: application/json");
-
-	std::string httpHeader = StrFormat("Content-Length: {0}", postData.length());
-	headers = curl_slist_append(headers, httpHeader.c_str());
-
-	curl_easy_setopt(_pCURL.get(), CURLOPT_HTTPHEADER, headers);
-
-	CURLcode error = curl_easy_perform(_pCURL.get());
-	curl_slist_free_all(headers);
-
-	if (error != CURLE_OK)
+	Notification notification;
+	notification.Key = StrFormat("slack|{0}|{1}", channel, message);
+	notification.BuildRequest = [=](const std::string& remark)
 	{
-		tlog::error() << StrFormat("Slack CURL error {0}", error);
-		return;
-	}
+		Request request;
+		request.Target = StrFormat("slack channel \"{0}\"", channel);
+		request.URL = StrFormat(
+			"https://{0}/services/hooks/incoming-webhook?token={1}", domain, key
+		);
 
-	long responseCode;
-	curl_easy_getinfo(_pCURL.get(), CURLINFO_RESPONSE_CODE, &responseCode);
+		request.Body = StrFormat(
+			R"(
+				{{
+					"channel":"{0}",
+					"username":"{1}",
+					"icon_url":"{2}",
+					"text":"{3}{4}"
+				}
+			)",
+			channel, username, iconURL, message, remark
+		);
 
-	if (responseCode != 200)
-	{
-		tlog::error() << StrFormat("Slack CURL response {0}", responseCode);
-		return;
-	}
+		request.Headers.emplace_back("Content-Type: application/json");
+		request.Headers.emplace_back(StrFormat("Content-Length: {0}", request.Body.length()));
+
+		return request;
+	};
 
-	tlog::success() << StrFormat("Sent message to slack channel \"{0}\". \"{1}: {2}\".", channel, username, message);
+	enqueue(std::move(notification));
 }
 
 void CURL::SendToSentry(
@@ -85,67 +109,257 @@ void CURL::SendToSentry(
 	std::string mode,
 	bool warning)
 {
-	std::string url = StrFormat("https://{0}/api/{1}/store/", domain, projectID);
-	curl_easy_setopt(_pCURL.get(), CURLOPT_URL, url.c_str());
-
 	std::string file = e.File();
 	std::replace(std::begin(file), std::end(file), '\\', '/');
 
-	std::string postData = StrFormat(
-		R"({{
-			"event_id":"{0}",
-			"message":"{1}",
-			"level":"{2}",
-			"tags": {{
-				"mode":"{3}"
-			},
-			"extra": {{
-				"file":"{4}",
-				"line":"{5}"
+	std::string description = e.Description();
+	s32 line = e.Line();
+
+	Notification notification;
+	notification.Key = StrFormat("sentry|{0}|{1}|{2}|{3}", mode, file, line, description);
+	notification.BuildRequest = [=](const std::string& remark)
+	{
+		Request request;
+		request.Target = "sentry";
+		request.URL = StrFormat("https://{0}/api/{1}/store/", domain, projectID);
+
+		request.Body = StrFormat(
+			R"({{
+				"event_id":"{0}",
+				"message":"{1}{6}",
+				"level":"{2}",
+				"tags": {{
+					"mode":"{3}"
+				},
+				"extra": {{
+					"file":"{4}",
+					"line":"{5}"
+				}
+			})",
+			UUID::V4().ToString(),
+			description,
+			warning ? "warning" : "error",
+			mode,
+			file,
+			line,
+			remark
+		);
+
+		request.Headers.emplace_back(StrFormat(
+			"X-Sentry-Auth: Sentry sentry_version=5,"
+			"sentry_client=cpp/1.0,"
+			"sentry_timestamp={0},"
+			"sentry_key={1},"
+			"sentry_secret={2}",
+			std::time(nullptr), publicKey, secretKey
+		));
+
+		return request;
+	};
+
+	enqueue(std::move(notification));
+}
+
+void CURL::enqueue(Notification notification)
+{
+	{
+		std::lock_guard<std::mutex> lock{_queueMutex};
+
+		if (_queue.size() >= s_maxQueueSize)
+		{
+			++_numDropped;
+			return;
+		}
+
+		_queue.emplace_back(std::move(notification));
+	}
+
+	_queueCondition.notify_one();
+}
+
+void CURL::run()
+{
+	std::deque<Request> ready;
+	steady_clock::time_point shutdownTime;
+	bool isShuttingDown = false;
+
+	while (true)
+	{
+		std::deque<Notification> incoming;
+
+		{
+			std::unique_lock<std::mutex> lock{_queueMutex};
+
+			// Only sleep here if there are no transfers to drive
+			if (_transfers.empty() && ready.empty() && _queue.empty() && !_shallShutdown)
+				_queueCondition.wait_for(lock, s_pollInterval);
+
+			std::swap(incoming, _queue);
+
+			if (_shallShutdown && !isShuttingDown)
+			{
+				isShuttingDown = true;
+				shutdownTime = steady_clock::now();
+			}
+		}
+
+		for (auto& notification : incoming)
+			coalesce(std::move(notification), ready);
+
+		// Nothing is waiting for a window to expire when shutting down
+		flushCoalesced(isShuttingDown, ready);
+
+		if (size_t numDropped = _numDropped.exchange(0))
+			tlog::warning() << StrFormat("Dropped {0} notifications because too many were queued.", numDropped);
+
+		auto now = steady_clock::now();
+		_numTokens = std::min(_numTokens + duration_cast<microseconds>(now - _lastRefillTime).count() * s_tokensPerSecond / 1e6, s_maxNumTokens);
+		_lastRefillTime = now;
+
+		while (!ready.empty() && _numTokens >= 1 && _transfers.size() < s_maxNumTransfers)
+		{
+			startTransfer(std::move(ready.front()));
+			ready.pop_front();
+			_numTokens -= 1;
+		}
+
+		if (!_transfers.empty())
+		{
+			int numRunning;
+			curl_multi_perform(_pMulti.get(), &numRunning);
+			finishTransfers();
+
+			if (!_transfers.empty())
+				curl_multi_wait(_pMulti.get(), nullptr, 0, (int)s_pollInterval.count(), nullptr);
+		}
+		else if (!ready.empty())
+			// Waiting for the rate limit
+			std::this_thread::sleep_for(s_pollInterval);
+
+		if (isShuttingDown)
+		{
+			bool isDone = _transfers.empty() && ready.empty();
+			if (!isDone && steady_clock::now() - shutdownTime > s_maxShutdownDuration)
+			{
+				tlog::warning() << StrFormat("Gave up on {0} notifications while shutting down.", _transfers.size() + ready.size());
+				break;
 			}
-		})",
-		UUID::V4().ToString(),
-		e.Description(),
-		warning ? "warning" : "error",
-		mode,
-		file,
-		e.Line()
-	);
-
-	curl_easy_setopt(_pCURL.get(), CURLOPT_CUSTOMREQUEST, "POST");
-	curl_easy_setopt(_pCURL.get(), CURLOPT_POSTFIELDS, postData.c_str());
-
-	struct curl_slist* headers = nullptr;
-	std::string httpHeader = StrFormat(
-		"X-Sentry-Auth: Sentry sentry_version=5,"
-		"sentry_client=cpp/1.0,"
-		"sentry_timestamp={0},"
-		"sentry_key={1},"
-		"sentry_secret={2}",
-		std::time(nullptr), publicKey, secretKey);
-	headers = curl_slist_append(headers, httpHeader.c_str());
-
-	curl_easy_setopt(_pCURL.get(), CURLOPT_HTTPHEADER, headers);
-
-	CURLcode error = curl_easy_perform(_pCURL.get());
-	curl_slist_free_all(headers);
-
-	if (error != CURLE_OK)
+
+			if (isDone)
+				break;
+		}
+	}
+}
+
+void CURL::coalesce(Notification notification, std::deque<Request>& ready)
+{
+	auto now = steady_clock::now();
+
+	auto coalescedIt = _coalesced.find(notification.Key);
+	if (coalescedIt != std::end(_coalesced) && now - coalescedIt->second.WindowStart < s_coalescingWindow)
 	{
-		tlog::error() << StrFormat("Sentry CURL error {0}", error);
+		++coalescedIt->second.NumRepeats;
 		return;
 	}
 
-	long responseCode;
-	curl_easy_getinfo(_pCURL.get(), CURLINFO_RESPONSE_CODE, &responseCode);
+	// The first occurrence is sent right away. Repeats are summarized at the end of the window.
+	ready.emplace_back(notification.BuildRequest(""));
+
+	std::string key = notification.Key;
+	_coalesced[key] = Coalesced{std::move(notification), now, 0};
+}
+
+void CURL::flushCoalesced(bool all, std::deque<Request>& ready)
+{
+	auto now = steady_clock::now();
+
+	for (auto it = std::begin(_coalesced); it != std::end(_coalesced);)
+	{
+		auto& coalesced = it->second;
+		if (!all && now - coalesced.WindowStart < s_coalescingWindow)
+		{
+			++it;
+			continue;
+		}
+
+		if (coalesced.NumRepeats == 0)
+		{
+			it = _coalesced.erase(it);
+			continue;
+		}
 
-	if (responseCode != 200)
+		ready.emplace_back(coalesced.First.BuildRequest(StrFormat(
+			" (repeated {0} times within {1}s)",
+			coalesced.NumRepeats, (s64)duration_cast<seconds>(now - coalesced.WindowStart).count()
+		)));
+
+		// Keep suppressing further repeats for another window
+		coalesced.WindowStart = now;
+		coalesced.NumRepeats = 0;
+		++it;
+	}
+}
+
+void CURL::startTransfer(Request request)
+{
+	::CURL* pHandle = curl_easy_init();
+	if (!pHandle)
 	{
-		tlog::error() << StrFormat("Sentry CURL response {0}", responseCode);
+		tlog::error() << StrFormat("Could not create CURL handle for {0}.", request.Target);
 		return;
 	}
 
-	tlog::success() << "Submitted exception to sentry.";
+	curl_slist* pHeaders = nullptr;
+	for (const auto& header : request.Headers)
+		pHeaders = curl_slist_append(pHeaders, header.c_str());
+
+	// The transfer owns the strings curl refers to until it is finished
+	auto& transfer = _transfers[pHandle];
+	transfer.Content = std::move(request);
+	transfer.pHeaders = pHeaders;
+
+	curl_easy_setopt(pHandle, CURLOPT_SSL_VERIFYPEER, false);
+	curl_easy_setopt(pHandle, CURLOPT_WRITEFUNCTION, EmptyCURLWriteData);
+	curl_easy_setopt(pHandle, CURLOPT_URL, transfer.Content.URL.c_str());
+	curl_easy_setopt(pHandle, CURLOPT_CUSTOMREQUEST, "POST");
+	curl_easy_setopt(pHandle, CURLOPT_POSTFIELDS, transfer.Content.Body.c_str());
+	curl_easy_setopt(pHandle, CURLOPT_HTTPHEADER, pHeaders);
+
+	curl_multi_add_handle(_pMulti.get(), pHandle);
+}
+
+void CURL::finishTransfers()
+{
+	int numMessages;
+	while (CURLMsg* pMessage = curl_multi_info_read(_pMulti.get(), &numMessages))
+	{
+		if (pMessage->msg != CURLMSG_DONE)
+			continue;
+
+		::CURL* pHandle = pMessage->easy_handle;
+		CURLcode error = pMessage->data.result;
+
+		auto transferIt = _transfers.find(pHandle);
+		const auto& target = transferIt->second.Content.Target;
+
+		if (error != CURLE_OK)
+			tlog::error() << StrFormat("CURL error {0} sending to {1}.", error, target);
+		else
+		{
+			long responseCode;
+			curl_easy_getinfo(pHandle, CURLINFO_RESPONSE_CODE, &responseCode);
+
+			if (responseCode != 200)
+				tlog::error() << StrFormat("CURL response {0} from {1}.", responseCode, target);
+			else
+				tlog::success() << StrFormat("Sent notification to {0}.", target);
+		}
+
+		curl_multi_remove_handle(_pMulti.get(), pHandle);
+		curl_easy_cleanup(pHandle);
+		curl_slist_free_all(transferIt->second.pHeaders);
+		_transfers.erase(transferIt);
+	}
 }
 
 PP_NAMESPACE_END
@@ -0,0 +1,438 @@
+#include <pp/Common.h>
+#include <pp/performance/Beatmap.h>
+#include <pp/performance/DatasetGenerator.h>
+
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <mutex>
+#include <set>
+#include <thread>
+
+using namespace std::chrono;
+
+PP_NAMESPACE_BEGIN
+
+namespace
+{
+	// Statements are kept well below the smallest common max_allowed_packet
+	const size_t s_maxQuerySize = 1024 * 1024;
+
+	// Roughly how often mod combinations are played
+	const std::vector<std::pair<u32, f64>> s_modFrequencies{
+		{Nomod, 40},
+		{Hidden, 18},
+		{HardRock, 5},
+		{DoubleTime, 8},
+		{Hidden | DoubleTime, 9},
+		{Hidden | HardRock, 6},
+		{Hidden | DoubleTime | HardRock, 2},
+		{NoFail, 3},
+		{Easy, 1},
+		{HalfTime, 1},
+		{Flashlight, 0.5},
+		{Hidden | Flashlight, 0.5},
+		{Hidden | HardRock | Flashlight, 0.2},
+		{Nightcore | DoubleTime, 2},
+		{Hidden | Nightcore | DoubleTime, 2},
+		{Perfect | SuddenDeath, 0.5},
+		{SpunOut, 0.3},
+	};
+
+	// Attribute IDs as used by osu-web
+	const std::vector<std::pair<u32, std::string>> s_attributeNames{
+		{1, "Aim"},
+		{3, "Speed"},
+		{5, "OD"},
+		{7, "AR"},
+		{9, "Max combo"},
+		{11, "Strain"},
+		{13, "Hit window 300"},
+		{15, "Score multiplier"},
+		{17, "Flashlight"},
+		{19, "Slider factor"},
+		{21, "Speed note count"},
+	};
+
+	u32 attributeId(const std::string& name)
+	{
+		for (const auto& attribute : s_attributeNames)
+			if (attribute.second == name)
+				return attribute.first;
+
+		throw DatasetGeneratorException{SRC_POS, StrFormat("Unknown attribute '{0}'.", name)};
+	}
+
+	// Accumulates rows into as few INSERT statements as possible
+	class BulkInsert
+	{
+	public:
+		BulkInsert(DatabaseConnection& db, std::string head)
+		: _db(db), _head{std::move(head)}
+		{
+		}
+
+		void Add(const std::string& values)
+		{
+			_query += _query.empty() ? _head : ",";
+			_query += '(';
+			_query += values;
+			_query += ')';
+
+			if (_query.size() >= s_maxQuerySize)
+				Flush();
+		}
+
+		void Flush()
+		{
+			if (_query.empty())
+				return;
+
+			_db.NonQuery(_query);
+			_query.clear();
+		}
+
+	private:
+		DatabaseConnection& _db;
+		std::string _head;
+		std::string _query;
+	};
+
+	void disableChecks(DatabaseConnection& db)
+	{
+		// Speeds up bulk loading. Generated IDs are unique anyways.
+		db.NonQuery("SET `unique_checks`=0, `foreign_key_checks`=0");
+	}
+}
+
+DatasetGenerator::DatasetGenerator(EGamemode gamemode, Parameters parameters)
+: _gamemode{gamemode}, _parameters(std::move(parameters))
+{
+	if (_parameters.NumUsers <= 0 || _parameters.NumBeatmaps <= 0 || _parameters.MeanScoresPerUser <= 0)
+		throw DatasetGeneratorException{SRC_POS, "Numbers of users, beatmaps and scores must be positive."};
+}
+
+void DatasetGenerator::Generate(const std::vector<std::shared_ptr<DatabaseConnection>>& dbConnections)
+{
+	if (dbConnections.empty())
+		throw DatasetGeneratorException{SRC_POS, "At least one connection is required."};
+
+	auto startTime = steady_clock::now();
+
+	auto& db = *dbConnections.front();
+	disableChecks(db);
+
+	if (_parameters.Truncate)
+		truncateTables(db);
+
+	generateDifficultyAttributeNames(db);
+	generateBeatmaps(db);
+
+	tlog::info() << StrFormat("Generating {0} users with {1} scores on average.", _parameters.NumUsers, _parameters.MeanScoresPerUser);
+
+	u32 numThreads = (u32)dbConnections.size();
+	std::vector<std::thread> threads;
+	std::vector<std::exception_ptr> exceptions(numThreads);
+	std::atomic<u32> numThreadsDone{0};
+
+	for (u32 i = 0; i < numThreads; ++i)
+	{
+		// Contiguous ranges of user IDs make for sequential inserts
+		s64 firstUserId = 1 + _parameters.NumUsers * i / numThreads;
+		s64 endUserId = 1 + _parameters.NumUsers * (i + 1) / numThreads;
+
+		threads.emplace_back([&, i, firstUserId, endUserId]()
+		{
+			try
+			{
+				disableChecks(*dbConnections[i]);
+				generateUsers(*dbConnections[i], firstUserId, endUserId, i);
+			}
+			catch (...)
+			{
+				exceptions[i] = std::current_exception();
+			}
+
+			++numThreadsDone;
+		});
+	}
+
+	auto lastLogTime = steady_clock::now();
+	while (numThreadsDone < numThreads)
+	{
+		std::this_thread::sleep_for(milliseconds{100});
+
+		if (steady_clock::now() - lastLogTime > seconds{5})
+		{
+			lastLogTime = steady_clock::now();
+			tlog::info() << StrFormat(
+				"Generated {0} of {1} users and {2} scores.",
+				(s64)_numUsersGenerated, _parameters.NumUsers, MaxScoreId()
+			);
+		}
+	}
+
+	for (auto& thread : threads)
+		thread.join();
+
+	for (const auto& exception : exceptions)
+		if (exception)
+			std::rethrow_exception(exception);
+
+	tlog::success() << StrFormat(
+		"Generated {0} beatmaps, {1} users and {2} scores in {3}s.",
+		_parameters.NumBeatmaps, _parameters.NumUsers, MaxScoreId(), (s64)duration_cast<seconds>(steady_clock::now() - startTime).count()
+	);
+}
+
+void DatasetGenerator::truncateTables(DatabaseConnection& db)
+{
+	tlog::info() << "Truncating tables.";
+
+	std::string suffix = GamemodeSuffix(_gamemode);
+	db.NonQuery(StrFormat(
+		"TRUNCATE TABLE `osu_beatmapsets`;"
+		"TRUNCATE TABLE `osu_beatmaps`;"
+		"TRUNCATE TABLE `osu_beatmap_difficulty_attribs`;"
+		"TRUNCATE TABLE `osu_scores{0}_high`;"
+		"TRUNCATE TABLE `osu_user_stats{0}`;"
+		"TRUNCATE TABLE `{1}`;",
+		suffix, _parameters.UserMetadataTableName
+	));
+}
+
+void DatasetGenerator::generateDifficultyAttributeNames(DatabaseConnection& db)
+{
+	BulkInsert insert{db, "INSERT IGNORE INTO `osu_difficulty_attribs`(`attrib_id`,`name`) VALUES"};
+	for (const auto& attribute : s_attributeNames)
+		insert.Add(StrFormat("{0},'{1}'", attribute.first, attribute.second));
+
+	insert.Flush();
+}
+
+void DatasetGenerator::generateBeatmaps(DatabaseConnection& db)
+{
+	static const s32 s_numBeatmapsPerSet = 4;
+
+	tlog::info() << StrFormat("Generating {0} beatmaps.", _parameters.NumBeatmaps);
+
+	std::mt19937_64 rng{_parameters.Seed};
+	std::lognormal_distribution<f64> numObjectsDistribution{std::log(500.0), 0.6};
+	std::uniform_real_distribution<f64> uniform{0, 1};
+
+	// Difficulty attributes only exist for the relevant mods of each combination
+	std::set<u32> difficultyMods;
+	for (const auto& mods : s_modFrequencies)
+		difficultyMods.insert(MaskRelevantDifficultyMods(_gamemode, static_cast<EMods>(mods.first)));
+
+	_beatmaps.clear();
+	_beatmaps.reserve(_parameters.NumBeatmaps);
+
+	BulkInsert beatmapSets{db,
+		"REPLACE INTO `osu_beatmapsets`(`beatmapset_id`,`approved`,`approved_date`) VALUES"
+	};
+
+	BulkInsert beatmaps{db,
+		"REPLACE INTO `osu_beatmaps`(`beatmap_id`,`beatmapset_id`,`playmode`,`approved`,`score_version`,`countNormal`,`countSlider`,`countSpinner`) VALUES"
+	};
+
+	BulkInsert attributes{db,
+		"REPLACE INTO `osu_beatmap_difficulty_attribs`(`beatmap_id`,`mode`,`mods`,`attrib_id`,`value`) VALUES"
+	};
+
+	for (s32 id = 1; id <= _parameters.NumBeatmaps; ++id)
+	{
+		s32 setId = (id - 1) / s_numBeatmapsPerSet + 1;
+		if ((id - 1) % s_numBeatmapsPerSet == 0)
+			beatmapSets.Add(StrFormat("{0},{1},DATE_SUB(NOW(), INTERVAL {2} DAY)", setId, Beatmap::Ranked, (s32)(uniform(rng) * 3650)));
+
+		GeneratedBeatmap beatmap;
+
+		s32 numObjects = std::max((s32)numObjectsDistribution(rng), 10);
+		f64 sliderFraction = 0.2 + 0.3 * uniform(rng);
+
+		beatmap.NumSliders = (s32)(numObjects * sliderFraction);
+		beatmap.NumSpinners = (s32)(uniform(rng) * 3);
+		beatmap.NumHitCircles = numObjects - beatmap.NumSliders - beatmap.NumSpinners;
+		beatmap.MaxCombo = beatmap.NumHitCircles + 3 * beatmap.NumSliders + beatmap.NumSpinners;
+
+		_beatmaps.emplace_back(beatmap);
+
+		beatmaps.Add(StrFormat(
+			"{0},{1},{2},{3},{4},{5},{6},{7}",
+			id, setId, _gamemode, Beatmap::Ranked, Beatmap::ScoreV1, beatmap.NumHitCircles, beatmap.NumSliders, beatmap.NumSpinners
+		));
+
+		// Star ratings are skewed towards easier beatmaps
+		f64 stars = 1 + 7 * std::pow(uniform(rng), 1.5);
+		f64 od = 4 + 6 * uniform(rng);
+		f64 ar = std::min(od + uniform(rng), 10.0);
+
+		for (u32 mods : difficultyMods)
+		{
+			f64 starsMultiplier = 1;
+			f64 odMultiplier = 1;
+			f64 arMultiplier = 1;
+
+			if (mods & DoubleTime)
+			{
+				starsMultiplier *= 1.4;
+				odMultiplier *= 1.3;
+				arMultiplier *= 1.25;
+			}
+			if (mods & HalfTime)
+			{
+				starsMultiplier *= 0.75;
+				odMultiplier *= 0.75;
+				arMultiplier *= 0.75;
+			}
+			if (mods & HardRock)
+			{
+				starsMultiplier *= 1.1;
+				odMultiplier *= 1.4;
+				arMultiplier *= 1.4;
+			}
+			if (mods & Easy)
+			{
+				starsMultiplier *= 0.8;
+				odMultiplier *= 0.5;
+				arMultiplier *= 0.5;
+			}
+
+			f64 modStars = stars * starsMultiplier;
+			f64 modOD = std::min(od * odMultiplier, 11.0);
+			f64 modAR = std::min(ar * arMultiplier, 11.0);
+
+			std::vector<std::pair<std::string, f64>> values;
+			values.emplace_back("Max combo", beatmap.MaxCombo);
+
+			switch (_gamemode)
+			{
+			case EGamemode::Osu:
+				values.emplace_back("Aim", modStars * 0.5);
+				values.emplace_back("Speed", modStars * 0.45);
+				values.emplace_back("OD", modOD);
+				values.emplace_back("AR", modAR);
+				values.emplace_back("Slider factor", 0.95 + 0.05 * uniform(rng));
+				values.emplace_back("Speed note count", beatmap.NumHitCircles * (0.2 + 0.3 * uniform(rng)));
+				if (mods & Flashlight)
+					values.emplace_back("Flashlight", modStars * 0.3);
+				break;
+			case EGamemode::Taiko:
+				values.emplace_back("Strain", modStars);
+				values.emplace_back("Hit window 300", 50 - 3 * modOD);
+				break;
+			case EGamemode::Catch:
+				values.emplace_back("Aim", modStars);
+				values.emplace_back("AR", modAR);
+				break;
+			case EGamemode::Mania:
+				values.emplace_back("Strain", modStars);
+				values.emplace_back("Hit window 300", 64 - 3 * modOD);
+				values.emplace_back("Score multiplier", (mods & (Easy | HalfTime)) ? 0.5 : 1.0);
+				break;
+			}
+
+			for (const auto& value : values)
+				attributes.Add(StrFormat("{0},{1},{2},{3},{4}", id, _gamemode, mods, attributeId(value.first), value.second));
+		}
+	}
+
+	beatmapSets.Flush();
+	beatmaps.Flush();
+	attributes.Flush();
+}
+
+void DatasetGenerator::generateUsers(DatabaseConnection& db, s64 firstUserId, s64 endUserId, u32 threadIndex)
+{
+	static const f64 s_scoresPerUserSigma = 1.5;
+
+	std::mt19937_64 rng{(u64)_parameters.Seed * 1000003 + threadIndex + 1};
+	std::uniform_real_distribution<f64> uniform{0, 1};
+
+	// Heavy tailed: few users have a lot of scores, most have only a few. The mean is as requested.
+	std::lognormal_distribution<f64> numScoresDistribution{
+		std::log(_parameters.MeanScoresPerUser) - s_scoresPerUserSigma * s_scoresPerUserSigma / 2,
+		s_scoresPerUserSigma
+	};
+
+	std::vector<f64> modWeights;
+	for (const auto& mods : s_modFrequencies)
+		modWeights.emplace_back(mods.second);
+
+	std::discrete_distribution<size_t> modsDistribution{std::begin(modWeights), std::end(modWeights)};
+
+	std::string suffix = GamemodeSuffix(_gamemode);
+
+	BulkInsert users{db, StrFormat(
+		"REPLACE INTO `{0}`(`user_id`,`username`,`user_warnings`,`user_type`) VALUES",
+		_parameters.UserMetadataTableName
+	)};
+
+	BulkInsert userStats{db, StrFormat(
+		"REPLACE INTO `osu_user_stats{0}`(`user_id`,`{1}`,`accuracy_new`,`last_played`) VALUES",
+		suffix, _parameters.UserPPColumnName
+	)};
+
+	BulkInsert scores{db, StrFormat(
+		"REPLACE INTO `osu_scores{0}_high`(`score_id`,`user_id`,`beatmap_id`,`score`,`maxcombo`,`rank`,`count50`,`count100`,`count300`,`countmiss`,`countgeki`,`countkatu`,`perfect`,`enabled_mods`,`date`,`pp`) VALUES",
+		suffix
+	)};
+
+	for (s64 userId = firstUserId; userId < endUserId; ++userId)
+	{
+		users.Add(StrFormat("{0},'user{0}',0,0", userId));
+
+		// A quarter of the users haven't played in over 3 months and thus don't get any pp
+		userStats.Add(StrFormat("{0},0,0,DATE_SUB(NOW(), INTERVAL {1} DAY)", userId, (s32)(uniform(rng) * 120)));
+
+		s64 numScores = std::min((s64)std::ceil(numScoresDistribution(rng)), (s64)_parameters.NumBeatmaps);
+		s64 scoreId = _nextScoreId.fetch_add(numScores);
+
+		// Better players miss less and play more often with difficulty increasing mods
+		f64 skill = uniform(rng);
+		f64 missProbability = 0.002 + 0.02 * (1 - skill);
+
+		for (s64 i = 0; i < numScores; ++i, ++scoreId)
+		{
+			// A small subset of popular beatmaps receives most of the scores
+			s32 beatmapId = 1 + std::min((s32)(_parameters.NumBeatmaps * std::pow(uniform(rng), 3)), _parameters.NumBeatmaps - 1);
+			const auto& beatmap = _beatmaps[beatmapId - 1];
+
+			u32 mods = s_modFrequencies[modsDistribution(rng)].first;
+
+			s32 numObjects = beatmap.NumHitCircles + beatmap.NumSliders + beatmap.NumSpinners;
+			std::binomial_distribution<s32> missDistribution{numObjects, missProbability};
+			std::binomial_distribution<s32> mehDistribution{numObjects, missProbability};
+			std::binomial_distribution<s32> okDistribution{numObjects, 0.01 + 0.08 * (1 - skill)};
+
+			s32 numMiss = missDistribution(rng);
+			s32 num50 = std::min(mehDistribution(rng), numObjects - numMiss);
+			s32 num100 = std::min(okDistribution(rng), numObjects - numMiss - num50);
+			s32 num300 = numObjects - numMiss - num50 - num100;
+
+			bool isPerfect = numMiss == 0 && uniform(rng) < 0.5;
+			s32 maxCombo = isPerfect ? beatmap.MaxCombo : (s32)(beatmap.MaxCombo * uniform(rng));
+
+			f64 accuracy = (num300 * 6.0 + num100 * 2.0 + num50) / (6.0 * numObjects);
+			std::string rank = numMiss == 0 && num100 + num50 == 0 ? "X" : accuracy > 0.95 ? "S" : accuracy > 0.9 ? "A" : "B";
+
+			s32 score = (s32)std::min(1e6 * accuracy * (0.5 + 0.5 * maxCombo / std::max(beatmap.MaxCombo, 1)), 1e6);
+
+			scores.Add(StrFormat(
+				"{0},{1},{2},{3},{4},'{5}',{6},{7},{8},{9},{10},{11},{12},{13},NOW(),NULL",
+				scoreId, userId, beatmapId, score, maxCombo, rank,
+				num50, num100, num300, numMiss, (s32)(num300 * 0.2), (s32)(num100 * 0.2),
+				isPerfect ? 1 : 0, mods
+			));
+		}
+
+		++_numUsersGenerated;
+	}
+
+	users.Flush();
+	userStats.Flush();
+	scores.Flush();
+}
+
+PP_NAMESPACE_END
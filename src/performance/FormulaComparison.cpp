@@ -0,0 +1,124 @@
+#include <pp/Common.h>
+#include <pp/performance/FormulaComparison.h>
+
+#include <cmath>
+
+PP_NAMESPACE_BEGIN
+
+FormulaComparison::FormulaComparison(EGamemode gamemode, const std::vector<std::string>& candidateNames, std::string filename)
+: _gamemode{gamemode}, _filename{std::move(filename)}
+{
+	for (const auto& name : candidateNames)
+		_candidates.emplace_back(&Formulas::FindCandidate(_gamemode, name));
+
+	_candidateTotals.resize(_candidates.size(), 0);
+	_candidateAbsoluteChanges.resize(_candidates.size(), 0);
+
+	_file.open(_filename);
+	if (!_file)
+		throw FormulaComparisonException{SRC_POS, StrFormat("Could not open '{0}' for writing.", _filename)};
+
+	tlog::info() << StrFormat("Comparing pp with {0} candidate formulas into '{1}'.", _candidates.size(), _filename);
+}
+
+FormulaComparison::UserComparison::UserComparison(const FormulaComparison& comparison, s64 userId)
+: _comparison(comparison), _userId{userId}
+{
+	_candidateUsers.resize(_comparison._candidates.size(), User{userId});
+}
+
+void FormulaComparison::UserComparison::AddScore(
+	f32 currentValue,
+	s64 scoreId,
+	s32 beatmapId,
+	s32 score,
+	s32 maxCombo,
+	s32 num300,
+	s32 num100,
+	s32 num50,
+	s32 numMiss,
+	s32 numGeki,
+	s32 numKatu,
+	EMods mods,
+	const Beatmap& beatmap
+)
+{
+	std::vector<f64> candidateValues;
+
+	for (size_t i = 0; i < _comparison._candidates.size(); ++i)
+	{
+		auto pScore = _comparison._candidates[i]->Create(
+			scoreId, _comparison._gamemode, _userId, beatmapId, score, maxCombo, num300, num100, num50, numMiss, numGeki, numKatu, mods, beatmap
+		);
+
+		auto record = pScore->CreatePPRecord();
+		_candidateUsers[i].AddScorePPRecord(record);
+		candidateValues.emplace_back(record.Value);
+	}
+
+	_lines += StrFormat(
+		"{{\"score_id\":{0},\"user_id\":{1},\"beatmap_id\":{2},\"pp\":{3}}\n",
+		scoreId, _userId, beatmapId, _comparison.ppObject(currentValue, candidateValues)
+	);
+}
+
+std::unique_ptr<FormulaComparison::UserComparison> FormulaComparison::BeginUser(s64 userId) const
+{
+	return std::make_unique<UserComparison>(*this, userId);
+}
+
+void FormulaComparison::EndUser(UserComparison& user, f64 currentValue)
+{
+	std::vector<f64> candidateValues;
+	for (auto& candidateUser : user._candidateUsers)
+	{
+		candidateUser.ComputePPRecord();
+		candidateValues.emplace_back(candidateUser.GetPPRecord().Value);
+	}
+
+	user._lines += StrFormat("{{\"user_id\":{0},\"pp\":{1}}\n", user._userId, ppObject(currentValue, candidateValues));
+
+	std::lock_guard<std::mutex> lock{_mutex};
+
+	_file << user._lines;
+	if (!_file)
+		throw FormulaComparisonException{SRC_POS, StrFormat("Could not write to '{0}'.", _filename)};
+
+	++_numUsers;
+	_currentTotal += currentValue;
+
+	for (size_t i = 0; i < candidateValues.size(); ++i)
+	{
+		_candidateTotals[i] += candidateValues[i];
+		_candidateAbsoluteChanges[i] += std::abs(candidateValues[i] - currentValue);
+	}
+}
+
+void FormulaComparison::LogSummary() const
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+
+	if (_numUsers == 0)
+		return;
+
+	tlog::info() << StrFormat("Compared formulas on {0} users. Mean pp of the current formula: {1}", _numUsers, _currentTotal / _numUsers);
+
+	for (size_t i = 0; i < _candidates.size(); ++i)
+	{
+		tlog::info() << StrFormat(
+			"Candidate '{0}': mean pp {1}, mean absolute change {2}",
+			_candidates[i]->Name, _candidateTotals[i] / _numUsers, _candidateAbsoluteChanges[i] / _numUsers
+		);
+	}
+}
+
+std::string FormulaComparison::ppObject(f64 currentValue, const std::vector<f64>& candidateValues) const
+{
+	std::string result = StrFormat("{{\"current\":{0}", currentValue);
+	for (size_t i = 0; i < _candidates.size(); ++i)
+		result += StrFormat(",\"{0}\":{1}", _candidates[i]->Name, candidateValues[i]);
+
+	return result + "}";
+}
+
+PP_NAMESPACE_END
@@ -0,0 +1,49 @@
+#include <pp/Common.h>
+#include <pp/performance/Formulas.h>
+
+#include <pp/performance/catch/CatchScore.h>
+#include <pp/performance/mania/ManiaScore.h>
+#include <pp/performance/osu/OsuScore.h>
+#include <pp/performance/taiko/TaikoScore.h>
+
+PP_NAMESPACE_BEGIN
+
+const std::vector<Formulas::Candidate>& Formulas::candidates()
+{
+	// Candidates are added here with their Score class, e.g.
+	// {"aim-rework", EGamemode::Osu, Factory<OsuScoreAimRework>()},
+	static const std::vector<Candidate> s_candidates{
+		// The current formulas themselves. Comparing with them has to yield no changes at all.
+		{"current", EGamemode::Osu,   Factory<OsuScore>()},
+		{"current", EGamemode::Taiko, Factory<TaikoScore>()},
+		{"current", EGamemode::Catch, Factory<CatchScore>()},
+		{"current", EGamemode::Mania, Factory<ManiaScore>()},
+	};
+
+	return s_candidates;
+}
+
+std::vector<std::string> Formulas::CandidateNames(EGamemode mode)
+{
+	std::vector<std::string> names;
+	for (const auto& candidate : candidates())
+		if (candidate.Mode == mode)
+			names.emplace_back(candidate.Name);
+
+	return names;
+}
+
+const Formulas::Candidate& Formulas::FindCandidate(EGamemode mode, const std::string& name)
+{
+	for (const auto& candidate : candidates())
+		if (candidate.Mode == mode && candidate.Name == name)
+			return candidate;
+
+	auto names = CandidateNames(mode);
+	throw FormulasException{SRC_POS, StrFormat(
+		"Unknown formula candidate '{0}' for {1}. Registered are: {2}",
+		name, GamemodeName(mode), names.empty() ? "none" : Join(names, ", ")
+	)};
+}
+
+PP_NAMESPACE_END
@@ -0,0 +1,355 @@
+#include <pp/Common.h>
+#include <pp/performance/LoadTrace.h>
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+using namespace std::chrono;
+using json = nlohmann::json;
+
+PP_NAMESPACE_BEGIN
+
+namespace
+{
+	// Entries which don't get processed within this time after the replay finished are given up on
+	const seconds s_maxWaitForProcessing{60};
+
+	const milliseconds s_watchInterval{10};
+
+	const size_t s_maxNumIdsPerQuery = 1000;
+
+	json rowToJson(QueryResult& res)
+	{
+		json row = json::object();
+		for (s32 i = 0; i < res.NumCols(); ++i)
+			row[res.ColumnName(i)] = res.IsNull(i) ? json(nullptr) : json((std::string)res[i]);
+
+		return row;
+	}
+
+	std::string toInsertQuery(DatabaseConnection& db, const std::string& verb, const std::string& table, const json& row)
+	{
+		std::vector<std::string> columns;
+		std::vector<std::string> values;
+
+		for (auto it = row.begin(); it != row.end(); ++it)
+		{
+			columns.emplace_back(StrFormat("`{0}`", it.key()));
+			values.emplace_back(it.value().is_null() ? "NULL" : StrFormat("'{0}'", db.Escape(it.value().get<std::string>())));
+		}
+
+		return StrFormat("{0} INTO `{1}`({2}) VALUES({3})", verb, table, Join(columns, ","), Join(values, ","));
+	}
+
+	f64 percentile(const std::vector<f64>& sortedValues, f64 p)
+	{
+		if (sortedValues.empty())
+			return 0;
+
+		return sortedValues[std::min((size_t)(p * sortedValues.size()), sortedValues.size() - 1)];
+	}
+}
+
+LoadTrace::LoadTrace(EGamemode gamemode, std::string filename)
+: _gamemode{gamemode}, _filename{std::move(filename)}
+{
+}
+
+void LoadTrace::Capture(DatabaseConnection& dbSource, seconds duration, milliseconds pollInterval, const std::atomic<bool>& shallStop)
+{
+	std::ofstream file{_filename};
+	if (!file)
+		throw LoadTraceException{SRC_POS, StrFormat("Could not open trace '{0}' for writing.", _filename)};
+
+	// Only entries arriving from now on are of interest
+	s64 lastQueueId = 0;
+	{
+		auto res = dbSource.Query(StrFormat("SELECT MAX(`queue_id`) FROM `score_process_queue` WHERE `mode`={0}", _gamemode));
+		if (res.NextRow() && !res.IsNull(0))
+			lastQueueId = res[0];
+	}
+
+	tlog::info() << StrFormat("Capturing queue entries after ID {0} into '{1}'.", lastQueueId, _filename);
+
+	auto startTime = steady_clock::now();
+	size_t numCaptured = 0;
+
+	while (!shallStop && (duration.count() == 0 || steady_clock::now() - startTime < duration))
+	{
+		auto res = dbSource.Query(StrFormat(
+			"SELECT * FROM `score_process_queue` WHERE `mode`={0} AND `queue_id`>{1} ORDER BY `queue_id` ASC LIMIT {2}",
+			_gamemode, lastQueueId, s_maxNumIdsPerQuery
+		));
+
+		// Arrival times are only accurate up to the poll interval
+		s64 time = duration_cast<milliseconds>(steady_clock::now() - startTime).count();
+
+		if (res.NumRows() == 0)
+		{
+			std::this_thread::sleep_for(pollInterval);
+			continue;
+		}
+
+		std::vector<json> entries;
+		std::vector<std::string> scoreIds;
+
+		while (res.NextRow())
+		{
+			entries.emplace_back(rowToJson(res));
+
+			const auto& entry = entries.back();
+			lastQueueId = std::max(lastQueueId, (s64)std::stoll(entry["queue_id"].get<std::string>()));
+
+			if (!entry["score_id"].is_null())
+				scoreIds.emplace_back(entry["score_id"].get<std::string>());
+		}
+
+		std::unordered_map<std::string, json> scores;
+		if (!scoreIds.empty())
+		{
+			auto scoreRes = dbSource.Query(StrFormat(
+				"SELECT * FROM `osu_scores{0}_high` WHERE `score_id` IN ({1})",
+				GamemodeSuffix(_gamemode), Join(scoreIds, ",")
+			));
+
+			while (scoreRes.NextRow())
+			{
+				json score = rowToJson(scoreRes);
+				scores[score["score_id"].get<std::string>()] = std::move(score);
+			}
+		}
+
+		for (auto& entry : entries)
+		{
+			auto scoreIt = entry["score_id"].is_null() ? std::end(scores) : scores.find(entry["score_id"].get<std::string>());
+
+			json record = {
+				{"time", time},
+				{"queue", std::move(entry)},
+				{"score", scoreIt == std::end(scores) ? json(nullptr) : scoreIt->second},
+			};
+
+			file << record.dump() << '\n';
+		}
+
+		file.flush();
+		if (!file)
+			throw LoadTraceException{SRC_POS, StrFormat("Could not write to trace '{0}'.", _filename)};
+
+		numCaptured += entries.size();
+		tlog::info() << StrFormat("Captured {0} queue entries so far.", numCaptured);
+	}
+
+	tlog::success() << StrFormat("Captured {0} queue entries within {1}s.", numCaptured, (s64)duration_cast<seconds>(steady_clock::now() - startTime).count());
+}
+
+void LoadTrace::Replay(DatabaseConnection& dbTarget, DatabaseConnection& dbWatch, f64 speed, const std::atomic<bool>& shallStop)
+{
+	struct Arrival
+	{
+		s64 Time;
+		json Queue;
+		json Score;
+	};
+
+	std::vector<Arrival> arrivals;
+
+	{
+		std::ifstream file{_filename};
+		if (!file)
+			throw LoadTraceException{SRC_POS, StrFormat("Could not open trace '{0}' for reading.", _filename)};
+
+		std::string line;
+		while (std::getline(file, line))
+		{
+			if (line.empty())
+				continue;
+
+			try
+			{
+				json record = json::parse(line);
+				arrivals.emplace_back(Arrival{record.at("time").get<s64>(), record.at("queue"), record.at("score")});
+			}
+			catch (const json::exception& e)
+			{
+				throw LoadTraceException{SRC_POS, StrFormat("Invalid record in trace '{0}': {1}", _filename, e.what())};
+			}
+		}
+	}
+
+	if (arrivals.empty())
+	{
+		tlog::warning() << StrFormat("Trace '{0}' is empty.", _filename);
+		return;
+	}
+
+	tlog::info() << StrFormat("Replaying {0} queue entries from '{1}'.", arrivals.size(), _filename);
+
+	// Maps the IDs of the inserted queue entries to the time of insertion
+	std::unordered_map<s64, steady_clock::time_point> pendingEntries;
+	std::mutex pendingMutex;
+
+	std::vector<f64> latencies;
+	std::atomic<bool> isReplayDone{false};
+	steady_clock::time_point lastProcessedTime;
+
+	std::thread watchThread{[&]()
+	{
+		auto lastProgressTime = steady_clock::now();
+		bool wasReplayDone = false;
+
+		while (!shallStop)
+		{
+			std::vector<std::string> ids;
+
+			{
+				std::lock_guard<std::mutex> lock{pendingMutex};
+
+				if (pendingEntries.empty() && isReplayDone)
+					break;
+
+				// Give the processor the full waiting time once everything is inserted
+				if (isReplayDone && !wasReplayDone)
+				{
+					wasReplayDone = true;
+					lastProgressTime = steady_clock::now();
+				}
+
+				for (const auto& entry : pendingEntries)
+				{
+					ids.emplace_back(std::to_string(entry.first));
+					if (ids.size() >= s_maxNumIdsPerQuery)
+						break;
+				}
+			}
+
+			if (!ids.empty())
+			{
+				try
+				{
+					auto res = dbWatch.Query(StrFormat(
+						"SELECT `queue_id` FROM `score_process_queue` WHERE `status`<>0 AND `queue_id` IN ({0})",
+						Join(ids, ",")
+					));
+
+					auto now = steady_clock::now();
+
+					std::lock_guard<std::mutex> lock{pendingMutex};
+
+					while (res.NextRow())
+					{
+						auto entryIt = pendingEntries.find((s64)res[0]);
+						if (entryIt == std::end(pendingEntries))
+							continue;
+
+						latencies.emplace_back(duration_cast<microseconds>(now - entryIt->second).count() / 1000.0);
+						pendingEntries.erase(entryIt);
+
+						lastProgressTime = lastProcessedTime = now;
+					}
+				}
+				catch (const DatabaseException& e)
+				{
+					if (!e.IsTransient())
+					{
+						tlog::error() << StrFormat("Stopped watching {0} queue entries: {1}", ids.size(), e.Description());
+						break;
+					}
+
+					// Measured latencies of the entries in question are too high by the time it takes to reconnect
+					tlog::warning() << StrFormat("Failed watching queue entries: {0}. Reconnecting.", e.Description());
+
+					try
+					{
+						dbWatch.Reconnect();
+					}
+					catch (const DatabaseException& e)
+					{
+						tlog::warning() << StrFormat("Failed reconnecting: {0}", e.Description());
+					}
+				}
+			}
+
+			if (isReplayDone && steady_clock::now() - lastProgressTime > s_maxWaitForProcessing)
+			{
+				std::lock_guard<std::mutex> lock{pendingMutex};
+				tlog::warning() << StrFormat("Giving up on {0} queue entries which were not processed.", pendingEntries.size());
+				break;
+			}
+
+			std::this_thread::sleep_for(s_watchInterval);
+		}
+	}};
+
+	auto startTime = steady_clock::now();
+	size_t numInserted = 0;
+
+	try
+	{
+		for (auto& arrival : arrivals)
+		{
+			if (shallStop)
+				break;
+
+			if (speed > 0)
+				std::this_thread::sleep_until(startTime + microseconds{(s64)(arrival.Time * 1000 / speed)});
+
+			if (!arrival.Score.is_null())
+				dbTarget.NonQuery(toInsertQuery(dbTarget, "REPLACE", StrFormat("osu_scores{0}_high", GamemodeSuffix(_gamemode)), arrival.Score));
+
+			// The entry receives a fresh ID and must appear unprocessed
+			arrival.Queue.erase("queue_id");
+			arrival.Queue["status"] = "0";
+
+			auto insertTime = steady_clock::now();
+			dbTarget.NonQuery(toInsertQuery(dbTarget, "INSERT", "score_process_queue", arrival.Queue));
+
+			auto res = dbTarget.Query("SELECT LAST_INSERT_ID()");
+			if (!res.NextRow())
+				throw LoadTraceException{SRC_POS, "Could not retrieve the ID of an inserted queue entry."};
+
+			{
+				std::lock_guard<std::mutex> lock{pendingMutex};
+				pendingEntries[(s64)res[0]] = insertTime;
+			}
+
+			++numInserted;
+		}
+	}
+	catch (...)
+	{
+		isReplayDone = true;
+		watchThread.join();
+		throw;
+	}
+
+	auto replayDuration = steady_clock::now() - startTime;
+	tlog::info() << StrFormat(
+		"Inserted {0} queue entries within {1}s. Waiting for them to be processed.",
+		numInserted, duration_cast<milliseconds>(replayDuration).count() / 1000.0
+	);
+
+	isReplayDone = true;
+	watchThread.join();
+
+	std::sort(std::begin(latencies), std::end(latencies));
+
+	f64 processingDuration = duration_cast<milliseconds>(lastProcessedTime - startTime).count() / 1000.0;
+
+	tlog::success() << StrFormat(
+		"Processed {0} of {1} queue entries at {2} entries/s.",
+		latencies.size(), numInserted, processingDuration > 0 ? latencies.size() / processingDuration : 0.0
+	);
+
+	tlog::success() << StrFormat(
+		"Latency [ms]: p50={0} p90={1} p99={2} max={3}",
+		percentile(latencies, 0.5), percentile(latencies, 0.9), percentile(latencies, 0.99), percentile(latencies, 1.0)
+	);
+}
+
+PP_NAMESPACE_END
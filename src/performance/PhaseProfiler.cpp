@@ -0,0 +1,194 @@
+#include <pp/Common.h>
+#include <pp/performance/PhaseProfiler.h>
+
+using namespace std::chrono;
+
+PP_NAMESPACE_BEGIN
+
+namespace
+{
+	// Profile of the calling thread, and the profiler it belongs to
+	thread_local const PhaseProfiler* s_pThreadProfiler = nullptr;
+	thread_local void* s_pThreadProfile = nullptr;
+}
+
+const char* PhaseProfiler::PhaseName(EPhase phase)
+{
+	switch (phase)
+	{
+	case EPhase::Fetch:     return "fetch";
+	case EPhase::Parse:     return "parse";
+	case EPhase::Compute:   return "compute";
+	case EPhase::Aggregate: return "aggregate";
+	case EPhase::Write:     return "write";
+	default:                return "unknown";
+	}
+}
+
+PhaseProfiler::Scope::Scope(PhaseProfiler* pProfiler, EPhase phase)
+: _pProfiler{pProfiler}, _phase{phase}
+{
+	begin();
+}
+
+PhaseProfiler::Scope::~Scope()
+{
+	end();
+}
+
+void PhaseProfiler::Scope::Switch(EPhase phase)
+{
+	end();
+	_phase = phase;
+	begin();
+}
+
+void PhaseProfiler::Scope::begin()
+{
+	if (!_pProfiler)
+		return;
+
+	_startValues = _pProfiler->threadProfile().Counters.Read();
+	_startTime = steady_clock::now();
+}
+
+void PhaseProfiler::Scope::end()
+{
+	if (!_pProfiler)
+		return;
+
+	auto& profile = _pProfiler->threadProfile();
+	auto endValues = profile.Counters.Read();
+	size_t phase = (size_t)_phase;
+
+	profile.Nanoseconds[phase] += (u64)duration_cast<nanoseconds>(steady_clock::now() - _startTime).count();
+
+	for (size_t i = 0; i < PerfCounters::NumEvents; ++i)
+		if (endValues[i] > _startValues[i])
+			profile.Events[phase][i] += endValues[i] - _startValues[i];
+}
+
+void PhaseProfiler::AddScores(u64 numScores)
+{
+	threadProfile().NumScores += numScores;
+}
+
+PhaseProfiler::ThreadProfile& PhaseProfiler::threadProfile()
+{
+	if (s_pThreadProfiler == this)
+		return *static_cast<ThreadProfile*>(s_pThreadProfile);
+
+	auto pProfile = std::make_unique<ThreadProfile>();
+
+	for (size_t phase = 0; phase < s_numPhases; ++phase)
+	{
+		for (auto& events : pProfile->Events[phase])
+			events = 0;
+
+		pProfile->Nanoseconds[phase] = 0;
+	}
+
+	pProfile->NumScores = 0;
+
+	s_pThreadProfiler = this;
+	s_pThreadProfile = pProfile.get();
+
+	std::lock_guard<std::mutex> lock{_mutex};
+
+	if (_threadProfiles.empty() && !pProfile->Counters.HasHardwareEvents())
+	{
+		tlog::warning() << (pProfile->Counters.IsAvailable(PerfCounters::TaskClock) ?
+			"Hardware events are unavailable for profiling. Falling back to software events." :
+			"Events are unavailable for profiling. Only measuring time.");
+	}
+
+	_threadProfiles.emplace_back(std::move(pProfile));
+	return *_threadProfiles.back();
+}
+
+void PhaseProfiler::LogReport() const
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+
+	if (_threadProfiles.empty())
+		return;
+
+	u64 numScores = 0;
+	for (const auto& pProfile : _threadProfiles)
+		numScores += pProfile->NumScores;
+
+	const auto& counters = _threadProfiles.front()->Counters;
+	bool hasHardwareEvents = counters.HasHardwareEvents();
+
+	tlog::info() << StrFormat("Profile of {0} scores on {1} threads:", numScores, _threadProfiles.size());
+
+	static const PerfCounters::EEvent s_eventsPerScore[] = {
+		PerfCounters::Instructions,
+		PerfCounters::CacheMisses,
+		PerfCounters::TLBMisses,
+		PerfCounters::BranchMisses,
+		PerfCounters::PageFaults,
+		PerfCounters::ContextSwitches,
+	};
+
+	for (size_t phase = 0; phase < s_numPhases; ++phase)
+	{
+		PerfCounters::values_t events;
+		events.fill(0);
+		u64 nanoseconds = 0;
+
+		for (const auto& pProfile : _threadProfiles)
+		{
+			for (size_t i = 0; i < PerfCounters::NumEvents; ++i)
+				events[i] += pProfile->Events[phase][i];
+
+			nanoseconds += pProfile->Nanoseconds[phase];
+		}
+
+		std::string line = StrFormat("  {0}: {1}ms", PhaseName((EPhase)phase), nanoseconds / 1000000);
+
+		if (counters.IsAvailable(PerfCounters::TaskClock))
+			line += StrFormat(", {0}ms on CPU", events[PerfCounters::TaskClock] / 1000000);
+
+		if (hasHardwareEvents && events[PerfCounters::Cycles] > 0)
+			line += StrFormat(", IPC {0}", (f64)events[PerfCounters::Instructions] / events[PerfCounters::Cycles]);
+
+		if (numScores > 0)
+		{
+			std::string perScore;
+			for (auto event : s_eventsPerScore)
+			{
+				if (counters.IsAvailable(event))
+					perScore += StrFormat("{0}{1} {2}", perScore.empty() ? "" : ", ", (f64)events[event] / numScores, PerfCounters::EventName(event));
+			}
+
+			if (!perScore.empty())
+				line += StrFormat("; per score: {0}", perScore);
+		}
+
+		tlog::info() << line;
+	}
+
+	if (!hasHardwareEvents)
+		return;
+
+	for (size_t i = 0; i < _threadProfiles.size(); ++i)
+	{
+		const auto& profile = *_threadProfiles[i];
+
+		u64 cycles = 0;
+		u64 instructions = 0;
+		for (size_t phase = 0; phase < s_numPhases; ++phase)
+		{
+			cycles += profile.Events[phase][PerfCounters::Cycles];
+			instructions += profile.Events[phase][PerfCounters::Instructions];
+		}
+
+		tlog::info() << StrFormat(
+			"  Thread {0}: {1} scores, IPC {2}",
+			i, (u64)profile.NumScores, cycles == 0 ? 0.0 : (f64)instructions / cycles
+		);
+	}
+}
+
+PP_NAMESPACE_END
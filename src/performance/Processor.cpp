@@ -1,4 +1,6 @@
 #include <pp/Common.h>
+#include <pp/performance/AttributeImport.h>
+#include <pp/performance/LoadTrace.h>
 #include <pp/performance/Processor.h>
 
 #include <pp/performance/osu/OsuScore.h>
@@ -11,6 +13,19 @@
 
 #include <nlohmann/json.hpp>
 
+#include <cctype>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <set>
+
+#ifndef _WIN32
+	#include <sys/wait.h>
+	#include <unistd.h>
+#endif
+
 using namespace std::chrono;
 
 PP_NAMESPACE_BEGIN
@@ -18,8 +33,20 @@ PP_NAMESPACE_BEGIN
 const Beatmap::ERankedStatus Processor::s_minRankedStatus = Beatmap::Ranked;
 const Beatmap::ERankedStatus Processor::s_maxRankedStatus = Beatmap::Approved;
 
-Processor::Processor(EGamemode gamemode, const std::string& configFile)
-: _gamemode{gamemode}
+const size_t Processor::s_maxNumIdsPerQuery = 1000;
+
+std::atomic<bool> Processor::s_shallShutdown{false};
+
+void Processor::onShutdownSignal(int signal)
+{
+	s_shallShutdown = true;
+
+	// A second signal terminates immediately, e.g. if draining the queues takes too long
+	std::signal(signal, SIG_DFL);
+}
+
+Processor::Processor(EGamemode gamemode, const std::string& configFile, bool lazyBeatmaps)
+: _lazyBeatmaps{lazyBeatmaps}, _gamemode{gamemode}
 {
 	tlog::none()
 		<< "---------------------------------------------------\n"
@@ -30,11 +57,27 @@ Processor::Processor(EGamemode gamemode, const std::string& configFile)
 
 	_isDocker = std::getenv("DOCKER") != NULL;
 
+	_pCurl = std::make_unique<CURL>();
 	_pDataDog = std::make_unique<DDog>(_config.DataDogHost, _config.DataDogPort);
 	_pDataDog->Increment("osu.pp.startups", 1, {StrFormat("mode:{0}", GamemodeTag(_gamemode))});
 
-	if (_isDocker)
+	auto startupTime = steady_clock::now();
+
+	auto connectSlave = [this]() { _pDBSlave = newDBConnectionSlave(); };
+
+	// Within docker, the database may not be up yet, in which case the slave connection has to wait for the master
+	std::future<void> slaveConnection;
+	if (!_isDocker)
+		slaveConnection = std::async(std::launch::async, &Processor::runStartupStage, this, "slave connection", connectSlave);
+
+	runStartupStage("master connection", [this]()
 	{
+		if (!_isDocker)
+		{
+			_pDB = newDBConnectionMaster();
+			return;
+		}
+
 		tlog::info() << "Waiting for database...";
 
 		while (true)
@@ -57,25 +100,125 @@ Processor::Processor(EGamemode gamemode, const std::string& configFile)
 
 			std::this_thread::sleep_for(seconds(1));
 		}
-	}
+	});
+
+	if (_isDocker)
+		runStartupStage("slave connection", connectSlave);
 	else
-		_pDB = newDBConnectionMaster();
+		slaveConnection.get();
 
-	_pDBSlave = newDBConnectionSlave();
+	if (!_config.ResidentMods.empty())
+	{
+		for (const auto& modsString : Split(_config.ResidentMods, ","))
+			_residentMods.insert(MaskRelevantDifficultyMods(_gamemode, ToMods(modsString)));
+
+		_pColdDifficulties = std::make_unique<LRUCache<u64, ColdDifficulty>>((size_t)std::max(_config.ColdCacheSize, 1));
+
+		tlog::info() << StrFormat("Keeping difficulty attributes of {0} mod combinations resident.", _residentMods.size());
+	}
+
+	for (const auto& modsString : Split(_config.PPTablesMods, ","))
+		_ppTableMods.emplace_back(ToMods(modsString));
+
+	for (const auto& accuracyString : Split(_config.PPTablesAccuracies, ","))
+		_ppTableAccuracies.emplace_back(std::stod(accuracyString) / 100);
+
+	for (const auto& missesString : Split(_config.PPTablesMisses, ","))
+		_ppTableMisses.emplace_back(std::stoi(missesString));
+
+	if (!_config.FormulaCandidates.empty())
+		_pFormulaComparison = std::make_unique<FormulaComparison>(_gamemode, Split(_config.FormulaCandidates, ","), _config.FormulaComparisonFile);
+
+	if (_config.ProfilingEnabled)
+		_pProfiler = std::make_unique<PhaseProfiler>();
+
+	if (_config.PinThreads || _config.ReplicateBeatmaps)
+	{
+		_numaTopology = NumaTopology::Detect();
+		tlog::info() << StrFormat("Detected {0} NUMA nodes.", _numaTopology.NumNodes());
+	}
+
+	// Only the beatmaps depend on the attribute names. Everything else is independent and retrieved concurrently,
+	// each through its own connection, as queries on a shared one are serialized.
+	std::vector<std::future<void>> stages;
+
+	stages.emplace_back(std::async(std::launch::async, &Processor::runStartupStage, this, "blacklist", [this]()
+	{
+		auto pDBSlave = newDBConnectionSlave();
+		queryBeatmapBlacklist(*pDBSlave);
+	}));
+
+	stages.emplace_back(std::async(std::launch::async, &Processor::runStartupStage, this, "beatmaps", [this]()
+	{
+		queryBeatmapDifficultyAttributes();
+
+		// Otherwise beatmaps are loaded once scores on them are encountered
+		if (!_lazyBeatmaps)
+			loadAllBeatmaps(4);
+	}));
+
+	if (_config.RankingEnabled)
+	{
+		stages.emplace_back(std::async(std::launch::async, &Processor::runStartupStage, this, "ranking", [this]()
+		{
+			buildRankIndex(4);
+		}));
+	}
+
+	for (auto& stage : stages)
+		stage.get();
 
-	queryBeatmapBlacklist();
-	queryBeatmapDifficultyAttributes();
-	queryAllBeatmapDifficulties(4);
+	s64 startupDuration = duration_cast<milliseconds>(steady_clock::now() - startupTime).count();
+	_pDataDog->Timing("osu.pp.startup.duration", startupDuration, {StrFormat("mode:{0}", GamemodeTag(_gamemode))});
+	tlog::success() << StrFormat("Started up in {0}ms.", startupDuration);
+
+	// Nothing needs to be preserved during startup, so only now start handling shutdown ourselves
+	std::signal(SIGINT, onShutdownSignal);
+	std::signal(SIGTERM, onShutdownSignal);
 }
 
 Processor::~Processor()
 {
-	if (_isDocker)
+	// The connections are closed while worker processes run
+	if (_isDocker && _pDB)
 		storeCount(*_pDB, "docker_db_step", 3);
 
+	logSummary();
+
 	tlog::info() << "Shutting down.";
 }
 
+void Processor::logSummary() const
+{
+	if (_pColdDifficulties)
+	{
+		u64 numHits = _pColdDifficulties->NumHits();
+		u64 numMisses = _pColdDifficulties->NumMisses();
+		u64 numLookups = numHits + numMisses;
+
+		tlog::info() << StrFormat(
+			"Cold difficulty cache: {0} hits, {1} misses ({2}% hit rate).",
+			numHits, numMisses, numLookups == 0 ? 0.0 : 100.0 * numHits / numLookups
+		);
+	}
+
+	if (_pFormulaComparison)
+		_pFormulaComparison->LogSummary();
+
+	if (_pProfiler)
+		_pProfiler->LogReport();
+}
+
+void Processor::runStartupStage(std::string name, std::function<void()> stage)
+{
+	auto startTime = steady_clock::now();
+	stage();
+
+	s64 duration = duration_cast<milliseconds>(steady_clock::now() - startTime).count();
+	_pDataDog->Timing("osu.pp.startup.stage_duration", duration, {StrFormat("mode:{0}", GamemodeTag(_gamemode)), StrFormat("stage:{0}", name)});
+	tlog::info() << StrFormat("Startup stage '{0}' took {1}ms.", name, duration);
+}
+
 void Processor::MonitorNewScores()
 {
 	_lastScorePollTime = steady_clock::now();
@@ -86,6 +229,11 @@ void Processor::MonitorNewScores()
 	_currentScoreId = retrieveCount(*_pDB, lastScoreIdKey());
 	_currentQueueId = 0;
 
+	enableJournal(*_pDB, "new");
+
+	if (_config.PPTablesEnabled)
+		createPPTable(*_pDB);
+
 	auto res = _pDBSlave->Query("SELECT MAX(`approved_date`) FROM `osu_beatmapsets` WHERE 1");
 
 	if (!res.NextRow())
@@ -93,13 +241,51 @@ void Processor::MonitorNewScores()
 
 	_lastApprovedDate = (std::string)res[0];
 
+	// Scores are processed right away, with the beatmaps they need loaded on demand until all of them are loaded
+	std::thread warmupThread;
+	if (_lazyBeatmaps)
+	{
+		auto warmup = [this]()
+		{
+			loadAllBeatmaps(std::max(_config.WarmupThreads, 1));
+
+			// From now on, beatmaps which are not loaded are known not to exist, like after loading them up front
+			if (!s_shallShutdown)
+				_lazyBeatmaps = false;
+		};
+
+		// Beatmaps loaded on demand come from the database, so they would disagree with the ones of the file in the meantime
+		if (_config.BackgroundWarmup && !_config.AttributesFile.empty())
+			tlog::warning() << "Background warmup is not supported with an attributes file. Loading all beatmaps first.";
+
+		if (_config.BackgroundWarmup && _config.AttributesFile.empty())
+			warmupThread = std::thread{warmup};
+		else
+			warmup();
+	}
+
+	if (!_config.BeatmapChangeColumn.empty())
+	{
+		auto changeRes = _pDBSlave->Query(StrFormat("SELECT MAX(`{0}`) FROM `osu_beatmaps` WHERE 1", _config.BeatmapChangeColumn));
+
+		if (!changeRes.NextRow() || changeRes.IsNull(0))
+			throw ProcessorException(SRC_POS, StrFormat("Couldn't find maximum of beatmap change column `{0}`.", _config.BeatmapChangeColumn));
+
+		_lastBeatmapChange = (std::string)changeRes[0];
+	}
+
 	std::thread beatmapPollThread{[this]()
 	{
 		auto pDbSlave = newDBConnectionSlave();
-		while (!_shallShutdown)
+		while (!s_shallShutdown)
 		{
 			if (steady_clock::now() - _lastBeatmapSetPollTime > milliseconds{_config.DifficultyUpdateInterval})
+			{
 				pollAndProcessNewBeatmapSets(*pDbSlave);
+
+				if (!_config.BeatmapChangeColumn.empty())
+					pollAndRefreshChangedBeatmaps(*pDbSlave);
+			}
 			else
 				std::this_thread::sleep_for(milliseconds(100));
 		}
@@ -107,7 +293,7 @@ void Processor::MonitorNewScores()
 
 	std::thread scorePollThread{[this]()
 	{
-		while (!_shallShutdown)
+		while (!s_shallShutdown)
 		{
 			if (steady_clock::now() - _lastScorePollTime > milliseconds{_config.ScoreUpdateInterval})
 				pollAndProcessNewScores();
@@ -116,26 +302,52 @@ void Processor::MonitorNewScores()
 		}
 	}};
 
+	std::thread queueCompactionThread;
+	if (_config.QueueCompactionEnabled)
+		queueCompactionThread = std::thread{&Processor::compactQueue, this};
+
+	// Sweeps through all scores over and over again, e.g. to pick up scores on beatmaps which got ranked later
+	std::thread backfillThread;
+	if (_config.BackfillEnabled)
+		backfillThread = std::thread{&Processor::backfillNullPP, this, std::max(_config.BackfillThreads, 1), true};
+
 	scorePollThread.join();
 	beatmapPollThread.join();
+
+	if (queueCompactionThread.joinable())
+		queueCompactionThread.join();
+
+	if (backfillThread.joinable())
+		backfillThread.join();
+
+	if (warmupThread.joinable())
+		warmupThread.join();
+
+	tlog::info() << StrFormat("Shutdown requested. Stopped after score ID {0}.", _currentScoreId);
+
+	// The queue entries of processed scores were already marked. All that is left is the score ID counter.
+	storeCount(*_pDB, lastScoreIdKey(), _currentScoreId);
+	waitForPendingQueries(*_pDB);
 }
 
 void Processor::ProcessAllUsers(bool reProcess, u32 numThreads)
 {
-	ThreadPool threadPool{numThreads};
+	processAllUsers(reProcess, numThreads, "all", lastUserIdKey(), "");
+}
+
+void Processor::processAllUsers(bool reProcess, u32 numThreads, const std::string& journalName, const std::string& checkpointKey, const std::string& partitionCondition)
+{
+	ThreadPool threadPool{numThreads, workerInitializer()};
 	std::vector<std::shared_ptr<DatabaseConnection>> dbConnections;
 	std::vector<std::shared_ptr<DatabaseConnection>> dbSlaveConnections;
 	std::vector<UpdateBatch> newUsersBatches;
 	std::vector<UpdateBatch> newScoresBatches;
 
-	for (u32 i = 0; i < numThreads; ++i)
-	{
-		dbConnections.push_back(newDBConnectionMaster());
-		dbSlaveConnections.push_back(newDBConnectionSlave());
+	replayOrphanedJournals(journalName, numThreads);
+	enableJournal(*_pDB, journalName);
 
-		newUsersBatches.emplace_back(dbConnections[i], 10000);
-		newScoresBatches.emplace_back(dbConnections[i], 10000);
-	}
+	openConnections(numThreads, journalName, dbConnections, dbSlaveConnections, newUsersBatches, newScoresBatches);
+	replicateBeatmaps();
 
 	static const s32 s_maxNumUsers = 10000;
 
@@ -145,14 +357,14 @@ void Processor::ProcessAllUsers(bool reProcess, u32 numThreads)
 		currentUserId = 0;
 
 		// Make sure in case of a restart we still do the full process, even if we didn't trigger a store before
-		storeCount(*_pDB, lastUserIdKey(), currentUserId);
+		storeCount(*_pDB, checkpointKey, currentUserId);
 	}
 	else
-		currentUserId = retrieveCount(*_pDB, lastUserIdKey());
+		currentUserId = retrieveCount(*_pDB, checkpointKey);
 
 	auto res = _pDBSlave->Query(StrFormat(
-		"SELECT COUNT(`user_id`) FROM `osu_user_stats{0}` WHERE `user_id`>={1}",
-		GamemodeSuffix(_gamemode), currentUserId
+		"SELECT COUNT(`user_id`) FROM `osu_user_stats{0}` WHERE `user_id`>={1}{2}",
+		GamemodeSuffix(_gamemode), currentUserId, partitionCondition
 	));
 
 	if (!res.NextRow())
@@ -167,35 +379,67 @@ void Processor::ProcessAllUsers(bool reProcess, u32 numThreads)
 	u32 currentConnection = 0;
 	auto lastProgressUpdate = steady_clock::now();
 
+	// Users are enqueued in ascending ID order, but complete in arbitrary order. Everything
+	// below the smallest ID that did not complete yet is done and can be skipped upon a restart.
+	std::set<s64> pendingUserIds;
+	std::mutex pendingUserIdsMutex;
+
+	auto completedUserId = [&]()
+	{
+		std::lock_guard<std::mutex> lock{pendingUserIdsMutex};
+		return pendingUserIds.empty() ? currentUserId : *std::begin(pendingUserIds) - 1;
+	};
+
 	// We will break out as soon as there are no more results
-	while (true)
+	while (!s_shallShutdown)
 	{
 		res = _pDBSlave->Query(StrFormat(
 			"SELECT "
 			"`user_id`"
 			"FROM `osu_user_stats{0}` "
-			"WHERE `user_id`>{1} ORDER BY `user_id` ASC LIMIT {2}",
-			GamemodeSuffix(_gamemode), currentUserId, s_maxNumUsers
+			"WHERE `user_id`>{1}{2} ORDER BY `user_id` ASC LIMIT {3}",
+			GamemodeSuffix(_gamemode), currentUserId, partitionCondition, s_maxNumUsers
 		));
 
 		if (res.NumRows() == 0)
 			break;
 
-		while (res.NextRow())
+		// Shut down when requested!
+		while (res.NextRow() && !s_shallShutdown)
 		{
 			s64 userId = res[0];
 
+			{
+				std::lock_guard<std::mutex> lock{pendingUserIdsMutex};
+				pendingUserIds.insert(userId);
+			}
+
 			threadPool.EnqueueTask(
 				[&, userId, currentConnection]()
 				{
-					processSingleUser(
-						0, // We want to update _all_ scores
-						*dbConnections[currentConnection],
-						*dbSlaveConnections[currentConnection],
-						newUsersBatches[currentConnection],
-						newScoresBatches[currentConnection],
-						userId
-					);
+					try
+					{
+						processSingleUser(
+							0, // We want to update _all_ scores
+							*dbConnections[currentConnection],
+							*dbSlaveConnections[currentConnection],
+							newUsersBatches[currentConnection],
+							newScoresBatches[currentConnection],
+							userId
+						);
+					}
+					catch (...)
+					{
+						// Failed users are not retried, hence they must not hold back the checkpoint.
+						std::lock_guard<std::mutex> lock{pendingUserIdsMutex};
+						pendingUserIds.erase(userId);
+						throw;
+					}
+
+					{
+						std::lock_guard<std::mutex> lock{pendingUserIdsMutex};
+						pendingUserIds.erase(userId);
+					}
 
 					++numUsersProcessed;
 				}
@@ -203,17 +447,13 @@ void Processor::ProcessAllUsers(bool reProcess, u32 numThreads)
 
 			currentConnection = (currentConnection + 1) % numThreads;
 			currentUserId = std::max(currentUserId, userId);
-
-			// Shut down when requested!
-			if (_shallShutdown)
-				return;
 		}
 
 		u32 numPendingQueries = 0;
 
 		do
 		{
-			u32 numPendingQueries = 0;
+			numPendingQueries = 0;
 			for (auto& pDBConn : dbConnections)
 				numPendingQueries += (u32)pDBConn->NumPendingQueries();
 
@@ -231,10 +471,44 @@ void Processor::ProcessAllUsers(bool reProcess, u32 numThreads)
 
 			std::this_thread::sleep_for(milliseconds{10});
 		}
-		while (threadPool.GetNumTasksInSystem() > 0 || numPendingQueries > 0);
+		while ((threadPool.GetNumTasksInSystem() > 0 || numPendingQueries > 0) && !s_shallShutdown);
+
+		// Users still in progress are finished below
+		if (s_shallShutdown)
+			break;
+
+		// Update our user_id counter, but only once the updates of all users below it reached the database
+		s64 checkpointUserId = completedUserId();
+		flushUpdates(newUsersBatches, newScoresBatches, dbConnections);
+		storeCount(*_pDB, checkpointKey, checkpointUserId);
+	}
+
+	if (s_shallShutdown)
+	{
+		tlog::info() << "Shutdown requested. Finishing users in progress.";
+
+		// Users that were not started yet remain pending and are hence picked up again on restart
+		threadPool.FlushQueue();
+		waitForTasks(threadPool);
+	}
+
+	flushUpdates(newUsersBatches, newScoresBatches, dbConnections);
+
+	// Only store the checkpoint once all updates of the users below it reached the database
+	s64 lastUserId = completedUserId();
+	storeCount(*_pDB, checkpointKey, lastUserId);
+	waitForPendingQueries(*_pDB);
+
+	if (s_shallShutdown)
+	{
+		tlog::success() << StrFormat(
+			"Processed {0} users for {1}. Stopped after user ID {2}.",
+			(s64)numUsersProcessed,
+			tlog::durationToString(progress.duration()),
+			lastUserId
+		);
 
-		// Update our user_id counter
-		storeCount(*_pDB, lastUserIdKey(), currentUserId);
+		return;
 	}
 
 	tlog::success() << StrFormat(
@@ -244,253 +518,1160 @@ void Processor::ProcessAllUsers(bool reProcess, u32 numThreads)
 	);
 }
 
-void Processor::ProcessSQL(u32 numThreads, std::string sql)
+void Processor::ProcessAllUsersInWorkers(bool reProcess, u32 numProcesses, u32 numThreads)
 {
-	ThreadPool threadPool{numThreads};
-	std::vector<std::shared_ptr<DatabaseConnection>> dbConnections;
-	std::vector<std::shared_ptr<DatabaseConnection>> dbSlaveConnections;
-	std::vector<UpdateBatch> newUsersBatches;
-	std::vector<UpdateBatch> newScoresBatches;
+#ifdef _WIN32
+	throw ProcessorException(SRC_POS, "Worker processes are not supported on Windows.");
+#else
+	static const u32 s_maxNumRestarts = 10;
 
-	for (u32 i = 0; i < numThreads; ++i)
+	numProcesses = std::max(numProcesses, 1u);
+
+	if (_pFormulaComparison)
+		throw ProcessorException(SRC_POS, "Formula comparison is not supported with worker processes.");
+
+	// Checkpoints are reset up front, such that restarted workers continue from theirs
+	for (u32 i = 0; i < numProcesses; ++i)
 	{
-		dbConnections.push_back(newDBConnectionMaster());
-		dbSlaveConnections.push_back(newDBConnectionSlave());
+		std::string checkpointKey = workerUserIdKey(i, numProcesses);
 
-		newUsersBatches.emplace_back(dbConnections[i], 10000);
-		newScoresBatches.emplace_back(dbConnections[i], 10000);
+		if (reProcess)
+			storeCount(*_pDB, checkpointKey, 0);
+		else if (_pDB->Query(StrFormat("SELECT 1 FROM `osu_counts` WHERE `name`='{0}'", checkpointKey)).NumRows() == 0)
+			throw ProcessorException(SRC_POS, StrFormat("There is no checkpoint of worker {0} to continue from. Did the previous run use {1} processes?", i, numProcesses));
 	}
 
-	auto res = _pDBSlave->Query(sql);
+	waitForPendingQueries(*_pDB);
 
-	if (res.NumRows() == 0)
-		throw ProcessorException(SRC_POS, "SQL query returned 0 users to process.");
-
-	const s64 numUsers = res.NumRows();
+	// Startup joined all threads that loaded the beatmaps. Those of the connections are closed here, such that
+	// the workers are forked from a single thread and share the beatmaps until they modify them.
+	disconnect();
 
-	tlog::info() << StrFormat("Processing {0} users.", numUsers);
-	auto progress = tlog::progress(numUsers);
+	struct Worker
+	{
+		pid_t Pid;
+		u32 NumRestarts;
+		bool Running;
+	};
 
-	std::atomic<s64> numUsersProcessed{0};
-	u32 currentConnection = 0;
-	auto lastProgressUpdate = steady_clock::now();
+	std::vector<Worker> workers(numProcesses, Worker{0, 0, false});
 
-	while (res.NextRow())
+	auto spawn = [&](u32 index)
 	{
-		s64 userId = res[0];
+		// Output buffered so far would otherwise be written by the worker, too
+		std::cout.flush();
+		std::cerr.flush();
 
-		threadPool.EnqueueTask(
-			[&, userId, currentConnection]() {
-				processSingleUser(
-					0, // We want to update _all_ scores
-					*dbConnections[currentConnection],
-					*dbSlaveConnections[currentConnection],
-					newUsersBatches[currentConnection],
-					newScoresBatches[currentConnection],
-					userId);
+		pid_t pid = fork();
+		if (pid < 0)
+			throw ProcessorException(SRC_POS, StrFormat("Could not fork worker {0}: {1}", index, std::strerror(errno)));
 
-				++numUsersProcessed;
-			});
+		if (pid == 0)
+			runWorker(index, numProcesses, numThreads, workers[index].NumRestarts);
 
-		currentConnection = (currentConnection + 1) % numThreads;
+		workers[index].Pid = pid;
+		workers[index].Running = true;
+		tlog::info() << StrFormat("Started worker {0} with PID {1}.", index, pid);
+	};
 
-		// Shut down when requested!
-		if (_shallShutdown)
-			return;
-	}
+	tlog::info() << StrFormat("Processing all users in {0} worker processes with {1} threads each.", numProcesses, numThreads);
+	auto startTime = steady_clock::now();
 
-	u32 numPendingQueries = 0;
+	for (u32 i = 0; i < numProcesses; ++i)
+		spawn(i);
 
-	do
+	u32 numRunning = numProcesses;
+	u32 numFailed = 0;
+	bool forwardedShutdown = false;
+
+	while (numRunning > 0)
 	{
-		u32 numPendingQueries = 0;
-		for (auto &pDBConn : dbConnections)
-			numPendingQueries += (u32)pDBConn->NumPendingQueries();
+		if (s_shallShutdown && !forwardedShutdown)
+		{
+			tlog::info() << "Shutdown requested. Waiting for workers to finish users in progress.";
+
+			for (const auto& worker : workers)
+				if (worker.Running)
+					kill(worker.Pid, SIGTERM);
 
-		_pDataDog->Gauge("osu.pp.db.pending_queries", numPendingQueries,
-						 {
-							 StrFormat("mode:{0}", GamemodeTag(_gamemode)),
-							 "connection:background",
-						 },
-						 0.01f);
+			forwardedShutdown = true;
+		}
+
+		int status;
+		pid_t pid = waitpid(-1, &status, WNOHANG);
 
-		if (steady_clock::now() - lastProgressUpdate > milliseconds{100})
+		if (pid == 0 || (pid < 0 && errno == EINTR))
 		{
-			progress.update(numUsersProcessed);
-			lastProgressUpdate += milliseconds{100};
+			std::this_thread::sleep_for(milliseconds{100});
+			continue;
 		}
 
-		std::this_thread::sleep_for(milliseconds{10});
-	} while (threadPool.GetNumTasksInSystem() > 0 || numPendingQueries > 0);
+		if (pid < 0)
+			throw ProcessorException(SRC_POS, StrFormat("Could not wait for workers: {0}", std::strerror(errno)));
 
-	tlog::success() << StrFormat(
-		"Processed all {0} users for {1}.",
-		numUsers,
-		tlog::durationToString(progress.duration()));
-}
+		auto it = std::find_if(std::begin(workers), std::end(workers), [pid](const Worker& worker) { return worker.Running && worker.Pid == pid; });
+		if (it == std::end(workers))
+			continue;
 
-void Processor::ProcessUsers(const std::vector<std::string> &userNames)
-{
-	std::vector<s64> userIds;
-	for (const auto& name : userNames)
-	{
-		s64 id = strtoll(name.c_str(), 0, 0);
-		if (id == 0)
+		u32 index = (u32)(it - std::begin(workers));
+		it->Running = false;
+
+		if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
 		{
-			// If the given string is not a number, try treating it as a username
-			auto res = _pDBSlave->Query(StrFormat(
-				"SELECT `user_id` FROM `{0}` WHERE `username`='{1}'",
-				_config.UserMetadataTableName, name
-			));
+			tlog::success() << StrFormat("Worker {0} finished.", index);
+			--numRunning;
+			continue;
+		}
 
-			if (!res.NextRow())
-				continue;
+		std::string reason = WIFSIGNALED(status) ?
+			StrFormat("was killed by signal {0}", WTERMSIG(status)) :
+			StrFormat("exited with code {0}", WEXITSTATUS(status));
 
-			id = res[0];
+		if (s_shallShutdown || it->NumRestarts >= s_maxNumRestarts)
+		{
+			tlog::error() << StrFormat("Worker {0} {1}. Not restarting it.", index, reason);
+			--numRunning;
+			++numFailed;
+			continue;
 		}
 
-		userIds.emplace_back(id);
+		++it->NumRestarts;
+		tlog::warning() << StrFormat("Worker {0} {1}. Restarting it from its checkpoint ({2}/{3}).", index, reason, it->NumRestarts, s_maxNumRestarts);
+
+		spawn(index);
 	}
 
-	ProcessUsers(userIds);
+	// Until destruction, which may still need the master
+	reconnect();
+
+	if (numFailed > 0)
+		throw ProcessorException(SRC_POS, StrFormat("{0} of {1} workers failed. Continue to retry their remaining users.", numFailed, numProcesses));
+
+	if (!s_shallShutdown)
+		tlog::success() << StrFormat("All workers finished in {0}.", tlog::durationToString(steady_clock::now() - startTime));
+#endif
 }
 
-void Processor::ProcessUsers(const std::vector<s64>& userIds)
+#ifndef _WIN32
+void Processor::runWorker(u32 index, u32 numProcesses, u32 numThreads, u32 numRestarts)
 {
-	UpdateBatch newUsers{_pDB, 10000};
-	UpdateBatch newScores{_pDB, 10000};
-
-	tlog::info() << StrFormat("Processing {0} users.", userIds.size());
-	auto progress = tlog::progress(userIds.size());
+	s32 exitCode = 0;
 
-	std::vector<User> users;
-	for (s64 userId : userIds)
+	try
 	{
-		users.emplace_back(processSingleUser(
-			0, // We want to update _all_ scores
-			*_pDB,
-			*_pDBSlave,
-			newUsers,
-			newScores,
-			userId
-		));
+		// Everything else, most notably the beatmaps, is inherited from the parent
+		reconnect();
+
+		if (numRestarts > 0)
+			_pDataDog->Increment("osu.pp.worker.restarts", 1, {StrFormat("mode:{0}", GamemodeTag(_gamemode))});
+
+		processAllUsers(
+			false,
+			numThreads,
+			StrFormat("all_{0}of{1}", index, numProcesses),
+			workerUserIdKey(index, numProcesses),
+			StrFormat(" AND `user_id`%{0}={1}", numProcesses, index)
+		);
 
-		progress.update(users.size());
+		// Waits for the background queries
+		disconnect();
+	}
+	catch (const Exception& e)
+	{
+		tlog::error() << StrFormat("Worker {0} failed: {1}", index, e.Description());
+		exitCode = 1;
+	}
+	catch (const std::exception& e)
+	{
+		tlog::error() << StrFormat("Worker {0} failed: {1}", index, e.what());
+		exitCode = 1;
 	}
 
-	tlog::info() << StrFormat("Sorting {0} users.", users.size());
-
-	std::sort(std::begin(users), std::end(users), [](const User& a, const User& b) {
-		if (a.GetPPRecord().Value != b.GetPPRecord().Value)
-			return a.GetPPRecord().Value > b.GetPPRecord().Value;
-
-		return a.Id() > b.Id();
-	});
-
-	tlog::success() << StrFormat(
-		"Processed {0} users for {1}.",
-		users.size(),
-		tlog::durationToString(progress.duration())
-	);
+	logSummary();
 
-	tlog::info() << "=============================================";
-	tlog::info() << "======= USER SUMMARY ========================";
-	tlog::info() << "=============================================";
-	tlog::info() << "            Name        Id    Perf.      Acc.";
-	tlog::info() << "---------------------------------------------";
+	// Returning would continue with the parent's command, and destruct the parent's processor
+	std::cout.flush();
+	std::cerr.flush();
+	_exit(exitCode);
+}
+#endif
 
-	for (const auto& user : users)
-	{
-		tlog::info() << StrFormat(
-			"{0w16ar}  {1w8ar}  {2w5ar}pp  {3w6arp2} %",
-			retrieveUserName(user.Id(), *_pDBSlave),
-			user.Id(),
-			(s32)std::round(user.GetPPRecord().Value),
-			user.GetPPRecord().Accuracy
-		);
-	}
+void Processor::disconnect()
+{
+	_pDB.reset();
+	_pDBSlave.reset();
+	_pCurl.reset();
+}
 
-	tlog::info() << "=============================================";
+void Processor::reconnect()
+{
+	_pCurl = std::make_unique<CURL>();
+	_pDB = newDBConnectionMaster();
+	_pDBSlave = newDBConnectionSlave();
 }
 
-void Processor::ProcessScores(const std::vector<s64>& scoreIds)
+void Processor::ProcessSQL(bool reProcess, u32 numThreads, std::string sql)
 {
-	UpdateBatch newUsers{_pDB, 10000};
-	UpdateBatch newScores{_pDB, 10000};
+	static const size_t s_maxNumUsersPerFetch = 100;
+	static const size_t s_maxNumUsersPerCheckpoint = 10000;
 
-	tlog::info() << StrFormat("Processing {0} scores.", scoreIds.size());
-	auto progress = tlog::progress(scoreIds.size());
+	ThreadPool threadPool{numThreads, workerInitializer()};
+	std::vector<std::shared_ptr<DatabaseConnection>> dbConnections;
+	std::vector<std::shared_ptr<DatabaseConnection>> dbSlaveConnections;
+	std::vector<UpdateBatch> newUsersBatches;
+	std::vector<UpdateBatch> newScoresBatches;
 
-	struct Result {
-		Score::PPRecord PP;
-		s64 UserId;
-		EMods Mods;
-	};
+	replayOrphanedJournals("sql", numThreads);
+	openConnections(numThreads, "sql", dbConnections, dbSlaveConnections, newUsersBatches, newScoresBatches);
+	replicateBeatmaps();
 
-	std::vector<Result> results;
+	// Progress is stored per statement, such that continuing a different statement starts from scratch
+	u32 sqlHash = 2166136261u;
+	for (char c : sql)
+		sqlHash = (sqlHash ^ (byte)c) * 16777619u;
 
-	for (s64 scoreId : scoreIds)
-	{
-		// Get user ID for this particular score
-		auto res = _pDBSlave->Query(StrFormat(
-			"SELECT `user_id`,`enabled_mods` FROM `osu_scores{0}_high` WHERE `score_id`='{1}'",
-			GamemodeSuffix(_gamemode), scoreId
-		));
+	std::string lastUserIdKey = StrFormat("pp_sql_{0}{1}", sqlHash, GamemodeSuffix(_gamemode));
 
-		if (!res.NextRow())
-			continue;
+	s64 lastUserId; // Will be initialized in the next few lines
+	if (reProcess)
+	{
+		lastUserId = 0;
+		storeCount(*_pDB, lastUserIdKey, lastUserId);
+	}
+	else
+		lastUserId = retrieveCount(*_pDB, lastUserIdKey);
 
-		User user = processSingleUser(scoreId, *_pDB, *_pDBSlave, newUsers, newScores, res[0]);
+	// The statement is wrapped to select the IDs a block at a time, in ascending order and without duplicates.
+	// This keeps only a single block in memory, and no result streams for the whole duration of processing.
+	while (!sql.empty() && (sql.back() == ';' || std::isspace((byte)sql.back())))
+		sql.pop_back();
+
+	std::string column;
+	{
+		auto res = _pDBSlave->Query(StrFormat("SELECT * FROM ({0}) AS `selected` LIMIT 0", sql));
+		column = res.ColumnName(0);
+	}
+
+	auto res = _pDBSlave->Query(StrFormat(
+		"SELECT COUNT(DISTINCT `{1}`) FROM ({0}) AS `selected` WHERE `{1}`>{2}",
+		sql, column, lastUserId
+	));
+
+	if (!res.NextRow())
+		throw ProcessorException(SRC_POS, "Could not count the selected users.");
+
+	const s64 numUsers = res[0];
+
+	if (numUsers == 0)
+	{
+		if (lastUserId == 0)
+			throw ProcessorException(SRC_POS, "SQL query returned 0 users to process.");
+
+		tlog::success() << StrFormat("All selected users were already processed after user ID {0}.", lastUserId);
+		return;
+	}
+
+	auto userCountRes = _pDBSlave->Query(StrFormat("SELECT COUNT(*) FROM `osu_user_stats{0}`", GamemodeSuffix(_gamemode)));
+	if (!userCountRes.NextRow())
+		throw ProcessorException(SRC_POS, "Could not find user count.");
+
+	// A range scan also reads the scores of all unselected users between the selected ones, i.e. about
+	// 1 - selectivity of the rows it reads are wasted. Once most users are selected, this is still
+	// cheaper than looking up each user individually.
+	f64 selectivity = (f64)numUsers / std::max((s64)userCountRes[0], (s64)1);
+	bool useRangeScan = selectivity >= _config.SQLRangeScanSelectivity;
+
+	tlog::info() << StrFormat(
+		"Processing {0} users with ID larger than {1} ({2p1}% of all users) using {3}.",
+		numUsers, lastUserId, selectivity * 100, useRangeScan ? "a range scan" : "batched lookups"
+	);
+
+	auto progress = tlog::progress(numUsers);
+
+	std::atomic<s64> numUsersProcessed{0};
+	u32 currentConnection = 0;
+	auto lastProgressUpdate = steady_clock::now();
+
+	// The first user ID of each chunk that did not complete yet. Everything below the smallest of them is done,
+	// and so is everything up to the last enqueued user if there are none.
+	std::set<s64> pendingChunks;
+	std::mutex pendingChunksMutex;
+	s64 enqueuedUserId = lastUserId;
+
+	auto completedUserId = [&]()
+	{
+		std::lock_guard<std::mutex> lock{pendingChunksMutex};
+		return pendingChunks.empty() ? enqueuedUserId : *std::begin(pendingChunks) - 1;
+	};
+
+	// Users are enqueued a block at a time, such that the updates of each block can be flushed before checkpointing it
+	while (!s_shallShutdown)
+	{
+		// Shared with the tasks, which outlive the block when shutting down
+		auto pUserIds = std::make_shared<std::vector<s64>>();
+		auto& userIds = *pUserIds;
 
-		auto scoreIt = std::find_if(std::begin(user.Scores()), std::end(user.Scores()), [scoreId](const Score::PPRecord& a)
 		{
-			return a.ScoreId == scoreId;
+			auto blockRes = _pDBSlave->Query(StrFormat(
+				"SELECT DISTINCT `{1}` FROM ({0}) AS `selected` WHERE `{1}`>{2} ORDER BY `{1}` LIMIT {3}",
+				sql, column, enqueuedUserId, s_maxNumUsersPerCheckpoint
+			));
+
+			userIds.reserve(blockRes.NumRows());
+			while (blockRes.NextRow())
+				if (!blockRes.IsNull(0))
+					userIds.emplace_back(blockRes[0]);
+		}
+
+		if (userIds.empty())
+			break;
+
+		for (size_t begin = 0; begin < userIds.size(); begin += s_maxNumUsersPerFetch)
+		{
+			size_t end = std::min(begin + s_maxNumUsersPerFetch, userIds.size());
+
+			{
+				std::lock_guard<std::mutex> lock{pendingChunksMutex};
+				pendingChunks.insert(userIds[begin]);
+				enqueuedUserId = userIds[end - 1];
+			}
+
+			threadPool.EnqueueTask(
+				[&, pUserIds, begin, end, currentConnection]()
+				{
+					const auto& userIds = *pUserIds;
+
+					std::string condition;
+					if (useRangeScan)
+						condition = StrFormat("`user_id` BETWEEN {0} AND {1}", userIds[begin], userIds[end - 1]);
+					else
+					{
+						std::vector<std::string> ids;
+						for (size_t i = begin; i < end; ++i)
+							ids.emplace_back(std::to_string(userIds[i]));
+
+						condition = StrFormat("`user_id` IN ({0})", Join(ids, ","));
+					}
+
+					auto scores = queryScores(*dbSlaveConnections[currentConnection], condition);
+
+					for (size_t i = begin; i < end; ++i)
+					{
+						try
+						{
+							processSingleUser(
+								0, // We want to update _all_ scores
+								*dbConnections[currentConnection],
+								*dbSlaveConnections[currentConnection],
+								newUsersBatches[currentConnection],
+								newScoresBatches[currentConnection],
+								userIds[i],
+								scores[userIds[i]]
+							);
+						}
+						catch (const Exception& e)
+						{
+							// Don't let a single user hold up the rest of the chunk
+							tlog::warning() << StrFormat("Skipping user {0}: {1}", userIds[i], e.Description());
+						}
+
+						++numUsersProcessed;
+					}
+
+					std::lock_guard<std::mutex> lock{pendingChunksMutex};
+					pendingChunks.erase(userIds[begin]);
+				}
+			);
+
+			currentConnection = (currentConnection + 1) % numThreads;
+		}
+
+		u32 numPendingQueries = 0;
+
+		do
+		{
+			numPendingQueries = 0;
+			for (auto &pDBConn : dbConnections)
+				numPendingQueries += (u32)pDBConn->NumPendingQueries();
+
+			_pDataDog->Gauge("osu.pp.db.pending_queries", numPendingQueries,
+							 {
+								 StrFormat("mode:{0}", GamemodeTag(_gamemode)),
+								 "connection:background",
+							 },
+							 0.01f);
+
+			if (steady_clock::now() - lastProgressUpdate > milliseconds{100})
+			{
+				progress.update(numUsersProcessed);
+				lastProgressUpdate += milliseconds{100};
+			}
+
+			std::this_thread::sleep_for(milliseconds{10});
+		} while ((threadPool.GetNumTasksInSystem() > 0 || numPendingQueries > 0) && !s_shallShutdown);
+
+		// Users still in progress are finished below
+		if (s_shallShutdown)
+			break;
+
+		// Only checkpoint users whose updates reached the database
+		s64 checkpointUserId = completedUserId();
+		flushUpdates(newUsersBatches, newScoresBatches, dbConnections);
+		storeCount(*_pDB, lastUserIdKey, checkpointUserId);
+	}
+
+	if (s_shallShutdown)
+	{
+		tlog::info() << "Shutdown requested. Finishing users in progress.";
+
+		threadPool.FlushQueue();
+		waitForTasks(threadPool);
+	}
+
+	flushUpdates(newUsersBatches, newScoresBatches, dbConnections);
+
+	lastUserId = completedUserId();
+	storeCount(*_pDB, lastUserIdKey, lastUserId);
+	waitForPendingQueries(*_pDB);
+
+	tlog::success() << StrFormat(
+		"Processed {0} of {1} users for {2}. Stopped after user ID {3}.",
+		(s64)numUsersProcessed,
+		numUsers,
+		tlog::durationToString(progress.duration()),
+		lastUserId);
+}
+
+void Processor::ProcessUsers(const std::vector<std::string>& userNames, u32 numThreads)
+{
+	std::vector<s64> userIds;
+	std::vector<std::string> names;
+
+	for (const auto& name : userNames)
+	{
+		s64 id = strtoll(name.c_str(), 0, 0);
+
+		// If the given string is not a number, try treating it as a username
+		if (id == 0)
+			names.emplace_back(name);
+		else
+			userIds.emplace_back(id);
+	}
+
+	for (size_t begin = 0; begin < names.size(); begin += s_maxNumIdsPerQuery)
+	{
+		std::vector<std::string> quotedNames;
+		for (size_t i = begin; i < std::min(begin + s_maxNumIdsPerQuery, names.size()); ++i)
+			quotedNames.emplace_back(StrFormat("'{0}'", _pDBSlave->Escape(names[i])));
+
+		auto res = _pDBSlave->Query(StrFormat(
+			"SELECT `user_id` FROM `{0}` WHERE `username` IN ({1})",
+			_config.UserMetadataTableName, Join(quotedNames, ",")
+		));
+
+		while (res.NextRow())
+			userIds.emplace_back(res[0]);
+	}
+
+	ProcessUsers(userIds, numThreads);
+}
+
+void Processor::ProcessUsers(const std::vector<s64>& userIds, u32 numThreads)
+{
+	ThreadPool threadPool{numThreads, workerInitializer()};
+	std::vector<std::shared_ptr<DatabaseConnection>> dbConnections;
+	std::vector<std::shared_ptr<DatabaseConnection>> dbSlaveConnections;
+	std::vector<UpdateBatch> newUsersBatches;
+	std::vector<UpdateBatch> newScoresBatches;
+
+	openConnections(numThreads, "", dbConnections, dbSlaveConnections, newUsersBatches, newScoresBatches);
+
+	tlog::info() << StrFormat("Processing {0} users.", userIds.size());
+	auto progress = tlog::progress(userIds.size());
+
+	std::vector<User> users;
+	std::mutex usersMutex;
+	u32 currentConnection = 0;
+
+	for (s64 userId : userIds)
+	{
+		threadPool.EnqueueTask(
+			[&, userId, currentConnection]()
+			{
+				User user = processSingleUser(
+					0, // We want to update _all_ scores
+					*dbConnections[currentConnection],
+					*dbSlaveConnections[currentConnection],
+					newUsersBatches[currentConnection],
+					newScoresBatches[currentConnection],
+					userId
+				);
+
+				std::lock_guard<std::mutex> lock{usersMutex};
+				users.emplace_back(std::move(user));
+				progress.update(users.size());
+			}
+		);
+
+		currentConnection = (currentConnection + 1) % numThreads;
+	}
+
+	waitForTasks(threadPool);
+	flushUpdates(newUsersBatches, newScoresBatches, dbConnections);
+
+	tlog::info() << StrFormat("Sorting {0} users.", users.size());
+
+	std::sort(std::begin(users), std::end(users), [](const User& a, const User& b) {
+		if (a.GetPPRecord().Value != b.GetPPRecord().Value)
+			return a.GetPPRecord().Value > b.GetPPRecord().Value;
+
+		return a.Id() > b.Id();
+	});
+
+	tlog::success() << StrFormat(
+		"Processed {0} users for {1}.",
+		users.size(),
+		tlog::durationToString(progress.duration())
+	);
+
+	std::vector<s64> processedUserIds;
+	for (const auto& user : users)
+		processedUserIds.emplace_back(user.Id());
+
+	auto userNames = retrieveUserNames(processedUserIds, *_pDBSlave);
+
+	tlog::info() << "=============================================";
+	tlog::info() << "======= USER SUMMARY ========================";
+	tlog::info() << "=============================================";
+	tlog::info() << "            Name        Id    Perf.      Acc.";
+	tlog::info() << "---------------------------------------------";
+
+	for (const auto& user : users)
+	{
+		tlog::info() << StrFormat(
+			"{0w16ar}  {1w8ar}  {2w5ar}pp  {3w6arp2} %",
+			userNames[user.Id()],
+			user.Id(),
+			(s32)std::round(user.GetPPRecord().Value),
+			user.GetPPRecord().Accuracy
+		);
+	}
+
+	tlog::info() << "=============================================";
+}
+
+void Processor::ProcessScores(const std::vector<s64>& scoreIds, u32 numThreads)
+{
+	ThreadPool threadPool{numThreads, workerInitializer()};
+	std::vector<std::shared_ptr<DatabaseConnection>> dbConnections;
+	std::vector<std::shared_ptr<DatabaseConnection>> dbSlaveConnections;
+	std::vector<UpdateBatch> newUsersBatches;
+	std::vector<UpdateBatch> newScoresBatches;
+
+	openConnections(numThreads, "", dbConnections, dbSlaveConnections, newUsersBatches, newScoresBatches);
+
+	tlog::info() << StrFormat("Processing {0} scores.", scoreIds.size());
+	auto progress = tlog::progress(scoreIds.size());
+
+	struct Result {
+		Score::PPRecord PP;
+		s64 UserId;
+		EMods Mods;
+	};
+
+	std::vector<Result> results;
+	std::mutex resultsMutex;
+	u32 currentConnection = 0;
+
+	struct SelectedScore
+	{
+		s64 ScoreId;
+		EMods Mods;
+	};
+
+	// Scores of the same user are processed together, since each task recomputes the user as a whole
+	std::unordered_map<s64, std::vector<SelectedScore>> userScores;
+
+	for (size_t begin = 0; begin < scoreIds.size(); begin += s_maxNumIdsPerQuery)
+	{
+		std::vector<std::string> ids;
+		for (size_t i = begin; i < std::min(begin + s_maxNumIdsPerQuery, scoreIds.size()); ++i)
+			ids.emplace_back(std::to_string(scoreIds[i]));
+
+		// Get user IDs of all scores of this chunk at once
+		auto res = _pDBSlave->Query(StrFormat(
+			"SELECT `score_id`,`user_id`,`enabled_mods` FROM `osu_scores{0}_high` WHERE `score_id` IN ({1})",
+			GamemodeSuffix(_gamemode), Join(ids, ",")
+		));
+
+		while (res.NextRow())
+			userScores[res[1]].push_back({res[0], res[2]});
+	}
+
+	for (const auto& entry : userScores)
+	{
+		s64 userId = entry.first;
+		const auto& selectedScores = entry.second;
+
+		// The newest score is looked at in isolation, like when it was just submitted
+		s64 newestScoreId = 0;
+		for (const auto& selectedScore : selectedScores)
+			newestScoreId = std::max(newestScoreId, selectedScore.ScoreId);
+
+		threadPool.EnqueueTask(
+			[&, userId, newestScoreId, currentConnection]()
+			{
+				User user = processSingleUser(
+					newestScoreId,
+					*dbConnections[currentConnection],
+					*dbSlaveConnections[currentConnection],
+					newUsersBatches[currentConnection],
+					newScoresBatches[currentConnection],
+					userId
+				);
+
+				for (const auto& selectedScore : selectedScores)
+				{
+					s64 scoreId = selectedScore.ScoreId;
+					auto scoreIt = std::find_if(std::begin(user.Scores()), std::end(user.Scores()), [scoreId](const Score::PPRecord& a)
+					{
+						return a.ScoreId == scoreId;
+					});
+
+					if (scoreIt == std::end(user.Scores()))
+					{
+						tlog::warning() << StrFormat("Could not find score ID {0} in result set.", scoreId);
+						continue;
+					}
+
+					std::lock_guard<std::mutex> lock{resultsMutex};
+					results.push_back({*scoreIt, user.Id(), selectedScore.Mods});
+					progress.update(results.size());
+				}
+			}
+		);
+
+		currentConnection = (currentConnection + 1) % numThreads;
+	}
+
+	waitForTasks(threadPool);
+	flushUpdates(newUsersBatches, newScoresBatches, dbConnections);
+
+	tlog::info() << StrFormat("Sorting {0} results.", results.size());
+
+	std::sort(std::begin(results), std::end(results), [](const Result& a, const Result& b) {
+		if (a.PP.Value != b.PP.Value)
+			return a.PP.Value > b.PP.Value;
+
+		return a.PP.ScoreId > b.PP.ScoreId;
+	});
+
+	tlog::success() << StrFormat(
+		"Processed {0} scores for {1}.",
+		scoreIds.size(),
+		tlog::durationToString(progress.duration())
+	);
+
+	std::vector<s64> userIds;
+	std::vector<s32> beatmapIds;
+	for (const auto& result : results)
+	{
+		userIds.emplace_back(result.UserId);
+		beatmapIds.emplace_back(result.PP.BeatmapId);
+	}
+
+	auto userNames = retrieveUserNames(userIds, *_pDBSlave);
+	auto beatmapNames = retrieveBeatmapNames(beatmapIds, *_pDBSlave);
+
+	tlog::info() << "================================================================================";
+	tlog::info() << "======= SCORE SUMMARY ==========================================================";
+	tlog::info() << "================================================================================";
+	tlog::info() << "            Name     Perf.      Acc.  Beatmap - Mods";
+	tlog::info() << "--------------------------------------------------------------------------------";
+
+	for (const auto& result : results)
+	{
+		tlog::info() << StrFormat(
+			"{0w16ar}  {1p1w6ar}pp  {2w6arp2} %  {3} - {4}",
+			userNames[result.UserId],
+			result.PP.Value,
+			result.PP.Accuracy * 100,
+			beatmapNames[result.PP.BeatmapId],
+			ToString(result.Mods)
+		);
+	}
+
+	tlog::info() << "================================================================================";
+}
+
+void Processor::CaptureLoad(const std::string& filename, u32 durationSeconds)
+{
+	LoadTrace trace{_gamemode, filename};
+	trace.Capture(*_pDBSlave, seconds{durationSeconds}, milliseconds{_config.ScoreUpdateInterval}, s_shallShutdown);
+}
+
+void Processor::ReplayLoad(const std::string& filename, f64 speed)
+{
+	auto pDBWatch = newDBConnectionMaster();
+
+	LoadTrace trace{_gamemode, filename};
+	trace.Replay(*_pDB, *pDBWatch, speed, s_shallShutdown);
+}
+
+void Processor::GenerateDataset(DatasetGenerator::Parameters parameters, u32 numThreads)
+{
+	parameters.UserPPColumnName = _config.UserPPColumnName;
+	parameters.UserMetadataTableName = _config.UserMetadataTableName;
+
+	std::vector<std::shared_ptr<DatabaseConnection>> dbConnections;
+	for (u32 i = 0; i < std::max(numThreads, 1u); ++i)
+		dbConnections.emplace_back(newDBConnectionMaster());
+
+	DatasetGenerator generator{_gamemode, std::move(parameters)};
+	generator.Generate(dbConnections);
+
+	// Start subsequent runs of `all -c` and `new` from scratch on the generated data
+	storeCount(*_pDB, lastUserIdKey(), 0);
+	storeCount(*_pDB, lastScoreIdKey(), generator.MaxScoreId());
+	waitForPendingQueries(*_pDB);
+}
+
+void Processor::ExportRanks(const std::string& filename)
+{
+	if (!_pRankIndex)
+		buildRankIndex(4);
+
+	std::ofstream file{filename};
+	if (!file)
+		throw ProcessorException{SRC_POS, StrFormat("Could not open '{0}' for writing.", filename)};
+
+	file << "user_id,rank\n";
+	for (const auto& rank : _pRankIndex->Ranks())
+		file << rank.first << ',' << rank.second << '\n';
+
+	if (!file)
+		throw ProcessorException{SRC_POS, StrFormat("Could not write ranks to '{0}'.", filename)};
+
+	tlog::success() << StrFormat("Exported ranks of {0} users into '{1}'.", _pRankIndex->NumUsers(), filename);
+}
+
+void Processor::BackfillNullPP(u32 numThreads)
+{
+	backfillNullPP(numThreads, false);
+}
+
+void Processor::ComputePPTables(u32 numThreads)
+{
+	static const size_t s_numBeatmapsPerTask = 100;
+
+	ThreadPool threadPool{numThreads, workerInitializer()};
+	std::vector<std::shared_ptr<DatabaseConnection>> dbConnections;
+	std::vector<std::shared_ptr<DatabaseConnection>> dbSlaveConnections;
+	std::vector<UpdateBatch> newUsersBatches;
+	std::vector<UpdateBatch> ppTablesBatches;
+
+	openConnections(numThreads, "", dbConnections, dbSlaveConnections, newUsersBatches, ppTablesBatches);
+	replicateBeatmaps();
+
+	createPPTable(*_pDB);
+
+	std::vector<s32> beatmapIds;
+	{
+		RWLock lock{&_beatmapMutex, false};
+		for (const auto& beatmap : _beatmaps)
+			beatmapIds.emplace_back(beatmap.first);
+	}
+
+	tlog::info() << StrFormat(
+		"Computing pp tables of {0} beatmaps for {1} mod combinations, {2} accuracies and {3} miss counts.",
+		beatmapIds.size(), _ppTableMods.size(), _ppTableAccuracies.size(), _ppTableMisses.size()
+	);
+
+	auto startTime = steady_clock::now();
+	auto progress = tlog::progress(beatmapIds.size());
+
+	size_t numBeatmapsProcessed = 0;
+	std::mutex progressMutex;
+	u32 currentConnection = 0;
+
+	for (size_t begin = 0; begin < beatmapIds.size() && !s_shallShutdown; begin += s_numBeatmapsPerTask)
+	{
+		size_t end = std::min(begin + s_numBeatmapsPerTask, beatmapIds.size());
+
+		threadPool.EnqueueTask(
+			[&, begin, end, currentConnection]()
+			{
+				for (size_t i = begin; i < end; ++i)
+					computePPTable(*dbSlaveConnections[currentConnection], ppTablesBatches[currentConnection], beatmapIds[i]);
+
+				std::lock_guard<std::mutex> lock{progressMutex};
+				numBeatmapsProcessed += end - begin;
+				progress.update(numBeatmapsProcessed);
+			}
+		);
+
+		currentConnection = (currentConnection + 1) % numThreads;
+	}
+
+	waitForTasks(threadPool);
+	flushUpdates(newUsersBatches, ppTablesBatches, dbConnections);
+
+	tlog::success() << StrFormat(
+		"Computed pp tables of {0} beatmaps in {1}s.",
+		numBeatmapsProcessed, (s64)duration_cast<seconds>(steady_clock::now() - startTime).count()
+	);
+}
+
+Processor::UserLock::UserLock(Processor* pProcessor, s64 userId)
+: _pProcessor{pProcessor}, _userId{userId}
+{
+	std::unique_lock<std::mutex> lock{_pProcessor->_lockedUserIdsMutex};
+	while (!_pProcessor->_lockedUserIds.insert(_userId).second)
+		_pProcessor->_lockedUserIdsCondition.wait(lock);
+}
+
+Processor::UserLock::~UserLock()
+{
+	{
+		std::lock_guard<std::mutex> lock{_pProcessor->_lockedUserIdsMutex};
+		_pProcessor->_lockedUserIds.erase(_userId);
+	}
+
+	_pProcessor->_lockedUserIdsCondition.notify_all();
+}
+
+void Processor::backfillNullPP(u32 numThreads, bool wrapAround)
+{
+	static const seconds s_wrapAroundInterval{60};
+
+	ThreadPool threadPool{numThreads, workerInitializer()};
+	std::vector<std::shared_ptr<DatabaseConnection>> dbConnections;
+	std::vector<std::shared_ptr<DatabaseConnection>> dbSlaveConnections;
+	std::vector<UpdateBatch> newUsersBatches;
+	std::vector<UpdateBatch> newScoresBatches;
+
+	openConnections(numThreads, "", dbConnections, dbSlaveConnections, newUsersBatches, newScoresBatches);
+
+	// Connections of their own, such that a background sweep never holds up the main ones
+	auto pDB = newDBConnectionMaster();
+	auto pDBSlave = newDBConnectionSlave();
+
+	auto queryMaxScoreId = [&]()
+	{
+		auto res = pDBSlave->Query(StrFormat("SELECT MAX(`score_id`) FROM `osu_scores{0}_high`", GamemodeSuffix(_gamemode)));
+		return res.NextRow() && !res.IsNull(0) ? (s64)res[0] : (s64)0;
+	};
+
+	s64 maxScoreId = queryMaxScoreId();
+	// There is no checkpoint before the first sweep
+	s64 scoreId = 0;
+	{
+		auto res = pDB->Query(StrFormat("SELECT `count` FROM `osu_counts` WHERE `name`='{0}'", backfillScoreIdKey()));
+		if (res.NextRow() && !res.IsNull(0))
+			scoreId = res[0];
+	}
+
+	tlog::info() << StrFormat("Backfilling pp of scores after ID {0}.", scoreId);
+
+	auto userInterval = microseconds{_config.BackfillRate > 0 ? (s64)(1e6 / _config.BackfillRate) : 0};
+	auto nextUserTime = steady_clock::now();
+
+	s64 numUsersProcessed = 0;
+	u32 currentConnection = 0;
+
+	while (!s_shallShutdown)
+	{
+		if (scoreId >= maxScoreId)
+		{
+			if (!wrapAround)
+				break;
+
+			tlog::info() << StrFormat("Backfilled pp up to score ID {0}. Starting over.", scoreId);
+
+			auto wakeTime = steady_clock::now() + s_wrapAroundInterval;
+			while (!s_shallShutdown && steady_clock::now() < wakeTime)
+				std::this_thread::sleep_for(milliseconds{100});
+
+			scoreId = 0;
+			storeCount(*pDB, backfillScoreIdKey(), scoreId);
+			maxScoreId = queryMaxScoreId();
+			continue;
+		}
+
+		s64 endScoreId = std::min(scoreId + _config.BackfillRangeSize, maxScoreId);
+
+		// The primary key bounds the scan. Only users with scores lacking pp are recomputed, and only if those are on beatmaps
+		// which are awarded pp in the first place. Otherwise the pp remain missing and the same users are recomputed on every sweep.
+		auto res = pDBSlave->Query(StrFormat(
+			"SELECT DISTINCT `osu_scores{0}_high`.`user_id` "
+			"FROM `osu_scores{0}_high` JOIN `osu_beatmaps` ON `osu_scores{0}_high`.`beatmap_id` = `osu_beatmaps`.`beatmap_id` "
+			"WHERE `score_id`>{1} AND `score_id`<={2} AND `osu_scores{0}_high`.`pp` IS NULL AND `approved` BETWEEN {3} AND {4} "
+			"AND `osu_scores{0}_high`.`beatmap_id` NOT IN (SELECT `beatmap_id` FROM `osu_beatmap_performance_blacklist` WHERE `mode`={5})",
+			GamemodeSuffix(_gamemode), scoreId, endScoreId, s_minRankedStatus, s_maxRankedStatus, _gamemode
+		));
+
+		while (!s_shallShutdown && res.NextRow())
+		{
+			s64 userId = res[0];
+
+			if (userInterval.count() > 0)
+			{
+				nextUserTime = std::max(nextUserTime + userInterval, steady_clock::now());
+				std::this_thread::sleep_until(nextUserTime);
+			}
+
+			threadPool.EnqueueTask(
+				[&, userId, currentConnection, wrapAround]()
+				{
+					// New scores of the user are processed concurrently
+					std::unique_ptr<UserLock> pLock;
+					if (wrapAround)
+						pLock = std::make_unique<UserLock>(this, userId);
+
+					processSingleUser(
+						0, // We want to update _all_ scores
+						*dbConnections[currentConnection],
+						*dbSlaveConnections[currentConnection],
+						newUsersBatches[currentConnection],
+						newScoresBatches[currentConnection],
+						userId
+					);
+
+					if (pLock)
+					{
+						newUsersBatches[currentConnection].Flush();
+						newScoresBatches[currentConnection].Flush();
+						waitForPendingQueries(*dbConnections[currentConnection]);
+					}
+				}
+			);
+
+			currentConnection = (currentConnection + 1) % numThreads;
+			++numUsersProcessed;
+		}
+
+		waitForTasks(threadPool);
+		flushUpdates(newUsersBatches, newScoresBatches, dbConnections);
+
+		// Interrupted ranges are swept again from their beginning
+		if (s_shallShutdown)
+			break;
+
+		_pDataDog->Increment("osu.pp.backfill.users", res.NumRows(), {StrFormat("mode:{0}", GamemodeTag(_gamemode))});
+
+		scoreId = endScoreId;
+		storeCount(*pDB, backfillScoreIdKey(), scoreId);
+	}
+
+	waitForPendingQueries(*pDB);
+
+	tlog::success() << StrFormat("Backfilled pp of {0} users up to score ID {1}.", numUsersProcessed, scoreId);
+}
+
+void Processor::buildRankIndex(u32 numThreads)
+{
+	tlog::info() << "Building rank index.";
+
+	auto startTime = steady_clock::now();
+
+	s64 maxUserId = 0;
+
+	// Not through the shared slave connection, such that the other startup stages aren't held up
+	{
+		auto pDBSlave = newDBConnectionSlave();
+		auto res = pDBSlave->Query(StrFormat("SELECT MAX(`user_id`) FROM `osu_user_stats{0}`", GamemodeSuffix(_gamemode)));
+		if (res.NextRow() && !res.IsNull(0))
+			maxUserId = res[0];
+	}
+
+	_pRankIndex = std::make_unique<RankIndex>();
+
+	std::vector<std::thread> threads;
+	std::vector<std::exception_ptr> exceptions(numThreads);
+
+	// Each thread reads a contiguous range of users through its own connection
+	for (u32 i = 0; i < numThreads; ++i)
+	{
+		s64 begin = maxUserId * i / numThreads;
+		s64 end = maxUserId * (i + 1) / numThreads;
+
+		threads.emplace_back([this, i, begin, end, &exceptions]()
+		{
+			try
+			{
+				auto pDBSlave = newDBConnectionSlave();
+				auto userRes = pDBSlave->QueryStreaming(StrFormat(
+					"SELECT `user_id`,`{0}` FROM `osu_user_stats{1}` WHERE `user_id`>{2} AND `user_id`<={3} AND `{0}`>0",
+					_config.UserPPColumnName, GamemodeSuffix(_gamemode), begin, end
+				));
+
+				while (userRes.NextRow())
+					_pRankIndex->Update(userRes[0], userRes[1]);
+			}
+			catch (...)
+			{
+				exceptions[i] = std::current_exception();
+			}
 		});
+	}
+
+	for (auto& thread : threads)
+		thread.join();
+
+	for (const auto& exception : exceptions)
+		if (exception)
+			std::rethrow_exception(exception);
+
+	tlog::success() << StrFormat(
+		"Ranked {0} users in {1}ms.",
+		_pRankIndex->NumUsers(), (s64)duration_cast<milliseconds>(steady_clock::now() - startTime).count()
+	);
+}
+
+void Processor::openConnections(
+	u32 numThreads,
+	const std::string& journalName,
+	std::vector<std::shared_ptr<DatabaseConnection>>& dbConnections,
+	std::vector<std::shared_ptr<DatabaseConnection>>& dbSlaveConnections,
+	std::vector<UpdateBatch>& newUsersBatches,
+	std::vector<UpdateBatch>& newScoresBatches
+)
+{
+	auto startTime = steady_clock::now();
 
-		if (scoreIt == std::end(user.Scores()))
+	dbConnections.resize(numThreads);
+	dbSlaveConnections.resize(numThreads);
+
+	std::vector<std::thread> threads;
+	std::vector<std::exception_ptr> exceptions(numThreads);
+
+	// Connecting is mostly waiting for the server, hence all connections are opened at once
+	for (u32 i = 0; i < numThreads; ++i)
+	{
+		threads.emplace_back([&, i]()
 		{
-			tlog::warning() << StrFormat("Could not find score ID {0} in result set.", scoreId);
-			continue;
-		}
+			try
+			{
+				dbConnections[i] = newDBConnectionMaster();
+				dbSlaveConnections[i] = newDBConnectionSlave();
 
-		results.push_back({*scoreIt, user.Id(), res[1]});
-		progress.update(results.size());
+				if (!journalName.empty())
+					enableJournal(*dbConnections[i], StrFormat("{0}_{1}", journalName, i));
+			}
+			catch (...)
+			{
+				exceptions[i] = std::current_exception();
+			}
+		});
 	}
 
-	tlog::info() << StrFormat("Sorting {0} results.", results.size());
+	for (auto& thread : threads)
+		thread.join();
 
-	std::sort(std::begin(results), std::end(results), [](const Result& a, const Result& b) {
-		if (a.PP.Value != b.PP.Value)
-			return a.PP.Value > b.PP.Value;
+	for (const auto& exception : exceptions)
+		if (exception)
+			std::rethrow_exception(exception);
 
-		return a.PP.ScoreId > b.PP.ScoreId;
-	});
+	for (u32 i = 0; i < numThreads; ++i)
+	{
+		newUsersBatches.emplace_back(dbConnections[i], 10000);
+		newScoresBatches.emplace_back(dbConnections[i], 10000);
+	}
 
-	tlog::success() << StrFormat(
-		"Processed {0} scores for {1}.",
-		scoreIds.size(),
-		tlog::durationToString(progress.duration())
+	tlog::info() << StrFormat(
+		"Opened {0} connections in {1}ms.",
+		2 * numThreads, (s64)duration_cast<milliseconds>(steady_clock::now() - startTime).count()
 	);
+}
 
-	tlog::info() << "================================================================================";
-	tlog::info() << "======= SCORE SUMMARY ==========================================================";
-	tlog::info() << "================================================================================";
-	tlog::info() << "            Name     Perf.      Acc.  Beatmap - Mods";
-	tlog::info() << "--------------------------------------------------------------------------------";
+std::function<void(u32)> Processor::workerInitializer() const
+{
+	if (!_config.PinThreads && !_config.ReplicateBeatmaps)
+		return nullptr;
 
-	for (const auto& result : results)
+	return [this](u32 worker)
 	{
-		tlog::info() << StrFormat(
-			"{0w16ar}  {1p1w6ar}pp  {2w6arp2} %  {3} - {4}",
-			retrieveUserName(result.UserId, *_pDBSlave),
-			result.PP.Value,
-			result.PP.Accuracy * 100,
-			retrieveBeatmapName(result.PP.BeatmapId, *_pDBSlave),
-			ToString(result.Mods)
-		);
+		u32 node = _numaTopology.NodeOfWorker(worker);
+
+		// Replication alone only needs workers to stay on their node
+		bool isPinned = _config.PinThreads ?
+			PinCurrentThread({_numaTopology.CpuOfWorker(worker)}) :
+			PinCurrentThread(_numaTopology.NodeCpus(node));
+
+		if (isPinned)
+			SetCurrentNumaNode((s32)node);
+		else
+			tlog::warning() << StrFormat("Could not pin worker thread {0}.", worker);
+	};
+}
+
+void Processor::replicateBeatmaps()
+{
+	if (!_config.ReplicateBeatmaps || _numaTopology.NumNodes() < 2)
+		return;
+
+	auto startTime = steady_clock::now();
+
+	RWLock lock{&_beatmapMutex, true};
+
+	_beatmapReplicas.clear();
+	_beatmapReplicas.resize(_numaTopology.NumNodes());
+
+	// Memory is placed on the node of the thread first touching it, hence copy from a thread on each node
+	std::vector<std::thread> threads;
+	for (size_t node = 0; node < _numaTopology.NumNodes(); ++node)
+	{
+		threads.emplace_back([this, node]()
+		{
+			PinCurrentThread(_numaTopology.NodeCpus(node));
+			_beatmapReplicas[node] = std::make_unique<std::unordered_map<s32, Beatmap>>(_beatmaps);
+		});
 	}
 
-	tlog::info() << "================================================================================";
+	for (auto& thread : threads)
+		thread.join();
+
+	tlog::success() << StrFormat(
+		"Replicated {0} beatmaps onto {1} NUMA nodes in {2}ms.",
+		_beatmaps.size(), _beatmapReplicas.size(), (s64)duration_cast<milliseconds>(steady_clock::now() - startTime).count()
+	);
+}
+
+const std::unordered_map<s32, Beatmap>& Processor::localBeatmaps() const
+{
+	s32 node = CurrentNumaNode();
+	if (node < 0 || (size_t)node >= _beatmapReplicas.size() || !_beatmapReplicas[node])
+		return _beatmaps;
+
+	return *_beatmapReplicas[node];
+}
+
+void Processor::waitForTasks(ThreadPool& threadPool)
+{
+	while (threadPool.GetNumTasksInSystem() > 0)
+		std::this_thread::sleep_for(milliseconds{10});
+}
+
+void Processor::flushUpdates(
+	std::vector<UpdateBatch>& newUsersBatches,
+	std::vector<UpdateBatch>& newScoresBatches,
+	const std::vector<std::shared_ptr<DatabaseConnection>>& dbConnections
+)
+{
+	for (auto& batch : newUsersBatches)
+		batch.Flush();
+
+	for (auto& batch : newScoresBatches)
+		batch.Flush();
+
+	for (auto& pDBConn : dbConnections)
+		waitForPendingQueries(*pDBConn);
+}
+
+void Processor::waitForPendingQueries(DatabaseConnection& db)
+{
+	while (db.NumPendingQueries() > 0)
+		std::this_thread::sleep_for(milliseconds{10});
 }
 
 void Processor::readConfig(const std::string& filename)
@@ -540,6 +1721,46 @@ void Processor::readConfig(const std::string& filename)
 
 		_config.DataDogHost = j.value("data-dog.host", "127.0.0.1");
 		_config.DataDogPort = j.value("data-dog.port", 8125);
+
+		_config.JournalPath = j.value("journal.path", "");
+
+		_config.SQLRangeScanSelectivity = j.value("sql.range-scan-selectivity", 0.5);
+
+		_config.ResidentMods =  j.value("beatmaps.resident-mods",   "");
+		_config.ColdCacheSize = j.value("beatmaps.cold-cache-size", 10000);
+
+		_config.BackgroundWarmup = j.value("beatmaps.background-warmup", true);
+		_config.WarmupThreads =    j.value("beatmaps.warmup-threads",    2);
+
+		_config.BeatmapChangeColumn = j.value("beatmaps.change-column", "");
+		_config.AttributesFile =      j.value("beatmaps.attributes-file", "");
+
+		_config.QueueCompactionEnabled =       j.value("queue-compaction.enabled",         false);
+		_config.QueueCompactionBatchSize =     j.value("queue-compaction.batch-size",      1000);
+		_config.QueueCompactionInterval =      j.value("queue-compaction.interval",        1000);
+		_config.QueueCompactionMaxReplicaLag = j.value("queue-compaction.max-replica-lag", 5);
+		_config.QueueCompactionArchiveTable =  j.value("queue-compaction.archive-table",   "");
+
+		_config.BackfillEnabled =   j.value("backfill.enabled",    false);
+		_config.BackfillThreads =   j.value("backfill.threads",    1);
+		_config.BackfillRangeSize = j.value("backfill.range-size", 100000);
+		_config.BackfillRate =      j.value("backfill.rate",       0.0);
+
+		_config.FormulaCandidates =     j.value("formulas.candidates",      "");
+		_config.FormulaComparisonFile = j.value("formulas.comparison-file", "formula-comparison.ndjson");
+
+		_config.ProfilingEnabled = j.value("profiling.enabled", false);
+
+		_config.PinThreads =        j.value("threads.pin",             false);
+		_config.ReplicateBeatmaps = j.value("numa.replicate-beatmaps", false);
+
+		_config.RankingEnabled = j.value("ranking.enabled", false);
+
+		_config.PPTablesEnabled =    j.value("pp-tables.enabled",    false);
+		_config.PPTablesTableName =  j.value("pp-tables.table",      "osu_beatmap_pp_tables");
+		_config.PPTablesMods =       j.value("pp-tables.mods",       "NM,HD,HR,DT,HDDT,HDHR");
+		_config.PPTablesAccuracies = j.value("pp-tables.accuracies", "95,98,99,100");
+		_config.PPTablesMisses =     j.value("pp-tables.misses",     "0,1,5");
 	}
 	catch (json::exception& e)
 	{
@@ -569,6 +1790,36 @@ std::shared_ptr<DatabaseConnection> Processor::newDBConnectionSlave()
 	);
 }
 
+std::string Processor::journalFilename(const std::string& name) const
+{
+	return StrFormat("{0}/{1}-{2}.journal", _config.JournalPath, GamemodeTag(_gamemode), name);
+}
+
+void Processor::enableJournal(DatabaseConnection& db, const std::string& name)
+{
+	if (_config.JournalPath.empty())
+		return;
+
+	db.EnableJournal(journalFilename(name), StrFormat("pp_journal{0}_{1}", GamemodeSuffix(_gamemode), name));
+}
+
+void Processor::replayOrphanedJournals(const std::string& name, u32 firstIndex)
+{
+	if (_config.JournalPath.empty())
+		return;
+
+	// Journals of connections beyond the ones used by this run are left over from
+	// a previous run with more threads. Their content still needs to reach the database.
+	for (u32 i = firstIndex; std::ifstream{journalFilename(StrFormat("{0}_{1}", name, i))}.good(); ++i)
+	{
+		auto pDB = newDBConnectionMaster();
+		enableJournal(*pDB, StrFormat("{0}_{1}", name, i));
+
+		while (pDB->NumPendingQueries() > 0)
+			std::this_thread::sleep_for(milliseconds{10});
+	}
+}
+
 void Processor::queryAllBeatmapDifficulties(u32 numThreads)
 {
 	static const s32 step = 1000;
@@ -600,6 +1851,15 @@ void Processor::queryAllBeatmapDifficulties(u32 numThreads)
 		threadIdx = (threadIdx + 1) % numThreads;
 
 		threadPool.EnqueueTask([&, begin]() {
+			// Loading in the background is abandoned when shutting down
+			if (s_shallShutdown)
+				return;
+
+			// Yield to beatmaps loaded on demand
+			{
+				PriorityLock lock{&_beatmapLoadMutex, false};
+			}
+
 			queryBeatmapDifficulty(dbSlave, begin, std::min(begin + step, maxBeatmapId + 1));
 
 			progress.update(_beatmaps.size());
@@ -618,53 +1878,106 @@ void Processor::queryAllBeatmapDifficulties(u32 numThreads)
 	);
 }
 
-bool Processor::queryBeatmapDifficulty(DatabaseConnection& dbSlave, s32 startId, s32 endId)
+void Processor::loadAllBeatmaps(u32 numThreads)
 {
-	std::string query = StrFormat(
-		"SELECT `osu_beatmaps`.`beatmap_id`,`countNormal`,`mods`,`attrib_id`,`value`,`approved`,`score_version`, `countSpinner`, `countSlider` "
-		"FROM `osu_beatmaps` "
-		"JOIN `osu_beatmap_difficulty_attribs` ON `osu_beatmaps`.`beatmap_id` = `osu_beatmap_difficulty_attribs`.`beatmap_id` "
-		"WHERE (`osu_beatmaps`.`playmode`=0 OR `osu_beatmaps`.`playmode`={0}) AND `osu_beatmap_difficulty_attribs`.`mode`={0} AND `approved` BETWEEN {1} AND {2}",
-		_gamemode, s_minRankedStatus, s_maxRankedStatus
-	);
-
-	if (endId == 0)
-		query += StrFormat(" AND `osu_beatmaps`.`beatmap_id`={0}", startId);
+	if (_config.AttributesFile.empty())
+		queryAllBeatmapDifficulties(numThreads);
 	else
-		query += StrFormat(" AND `osu_beatmaps`.`beatmap_id`>={0} AND `osu_beatmaps`.`beatmap_id`<{1}", startId, endId);
+		importAllBeatmapDifficulties(numThreads);
+}
 
-	auto res = dbSlave.Query(query);
+void Processor::importAllBeatmapDifficulties(u32 numThreads)
+{
+	tlog::info() << StrFormat("Importing all beatmap difficulties from '{0}'.", _config.AttributesFile);
 
-	bool success = res.NumRows() != 0;
+	auto startTime = steady_clock::now();
 
-	RWLock lock{&_beatmapMutex, success};
+	// Only the attributes come from the file. Everything else about the beatmaps is unaffected by the difficulty calculator.
+	std::unordered_map<s32, Beatmap> beatmaps;
 
-	while (res.NextRow())
 	{
-		s32 id = res[0];
+		auto res = _pDBSlave->QueryStreaming(StrFormat(
+			"SELECT `beatmap_id`,`countNormal`,`approved`,`score_version`,`countSpinner`,`countSlider` "
+			"FROM `osu_beatmaps` "
+			"WHERE (`playmode`=0 OR `playmode`={0}) AND `approved` BETWEEN {1} AND {2}",
+			_gamemode, s_minRankedStatus, s_maxRankedStatus
+		));
 
-		if (_beatmaps.count(id) == 0)
-			_beatmaps.emplace(std::make_pair(id, id));
+		while (res.NextRow())
+		{
+			s32 id = res[0];
 
-		auto& beatmap = _beatmaps.at(id);
+			Beatmap beatmap{id};
+			beatmap.SetMode(_gamemode);
+			beatmap.SetRankedStatus(res[2]);
+			beatmap.SetScoreVersion(res[3]);
+			beatmap.SetNumHitCircles(res.IsNull(1) ? 0 : (s32)res[1]);
+			beatmap.SetNumSliders(res.IsNull(5) ? 0 : (s32)res[5]);
+			beatmap.SetNumSpinners(res.IsNull(4) ? 0 : (s32)res[4]);
 
-		beatmap.SetRankedStatus(res[5]);
-		beatmap.SetScoreVersion(res[6]);
-		beatmap.SetNumHitCircles(res.IsNull(1) ? 0 : (s32)res[1]);
-		beatmap.SetNumSliders(res.IsNull(8) ? 0 : (s32)res[8]);
-		beatmap.SetNumSpinners(res.IsNull(7) ? 0 : (s32)res[7]);
+			beatmaps.emplace(id, std::move(beatmap));
+		}
+	}
 
-		s32 attribId = (s32)res[3];
-		if (attribId < _difficultyAttributes.size())
-			beatmap.SetDifficultyAttribute(res[2], _difficultyAttributes[attribId], res[4]);
+	AttributeImport import{_gamemode, _config.AttributesFile};
+	auto entries = import.Read(_difficultyAttributes, numThreads);
+
+	std::unordered_set<s32> idsWithAttributes;
+	size_t numUnknown = 0;
+
+	for (const auto& entry : entries)
+	{
+		if (!_residentMods.empty() && _residentMods.count(MaskRelevantDifficultyMods(_gamemode, entry.Mods)) == 0)
+			continue;
+
+		auto beatmapIt = beatmaps.find(entry.BeatmapId);
+		if (beatmapIt == std::end(beatmaps))
+		{
+			++numUnknown;
+			continue;
+		}
 
-		beatmap.SetMode(_gamemode);
+		beatmapIt->second.SetDifficultyAttributes(entry.Mods, entry.Attributes);
+		idsWithAttributes.insert(entry.BeatmapId);
 	}
 
+	if (numUnknown > 0)
+		tlog::warning() << StrFormat("Skipped {0} imported attributes of beatmaps which are not ranked.", numUnknown);
+
+	size_t numMissing = beatmaps.size() - idsWithAttributes.size();
+	if (numMissing > 0)
+		tlog::warning() << StrFormat("Skipped {0} ranked beatmaps without imported attributes.", numMissing);
+
+	RWLock lock{&_beatmapMutex, true};
+
+	_beatmapReplicas.clear();
+
+	for (auto& beatmap : beatmaps)
+		if (idsWithAttributes.count(beatmap.first) > 0)
+			publishBeatmap(std::move(beatmap.second));
+
+	tlog::success() << StrFormat(
+		"Imported {0} attributes for a total of {1} beatmaps in {2}ms.",
+		entries.size(), _beatmaps.size(), (s64)duration_cast<milliseconds>(steady_clock::now() - startTime).count()
+	);
+}
+
+bool Processor::queryBeatmapDifficulty(DatabaseConnection& dbSlave, s32 startId, s32 endId)
+{
+	std::string condition;
+	if (endId == 0)
+		condition = StrFormat("`osu_beatmaps`.`beatmap_id`={0}", startId);
+	else
+		condition = StrFormat("`osu_beatmaps`.`beatmap_id`>={0} AND `osu_beatmaps`.`beatmap_id`<{1}", startId, endId);
+
+	bool success = queryBeatmapDifficulties(dbSlave, condition);
+
 	if (endId != 0) {
 		return success;
 	}
 
+	RWLock lock{&_beatmapMutex, false};
+
 	if (_beatmaps.count(startId) == 0)
 	{
 		std::string message = StrFormat("Couldn't find beatmap /b/{0}.", startId);
@@ -693,6 +2006,188 @@ bool Processor::queryBeatmapDifficulty(DatabaseConnection& dbSlave, s32 startId,
 	return success;
 }
 
+bool Processor::queryBeatmapDifficulties(DatabaseConnection& dbSlave, const std::string& condition)
+{
+	auto beatmaps = loadBeatmaps(dbSlave, condition);
+	if (beatmaps.empty())
+		return false;
+
+	RWLock lock{&_beatmapMutex, true};
+
+	// Replicas would be stale. Workers fall back to _beatmaps until they are created again.
+	_beatmapReplicas.clear();
+
+	for (auto& beatmap : beatmaps)
+		publishBeatmap(std::move(beatmap.second));
+
+	return true;
+}
+
+std::unordered_map<s32, Beatmap> Processor::loadBeatmaps(DatabaseConnection& dbSlave, const std::string& condition)
+{
+	auto res = dbSlave.Query(StrFormat(
+		"SELECT `osu_beatmaps`.`beatmap_id`,`countNormal`,`mods`,`attrib_id`,`value`,`approved`,`score_version`, `countSpinner`, `countSlider` "
+		"FROM `osu_beatmaps` "
+		"JOIN `osu_beatmap_difficulty_attribs` ON `osu_beatmaps`.`beatmap_id` = `osu_beatmap_difficulty_attribs`.`beatmap_id` "
+		"WHERE (`osu_beatmaps`.`playmode`=0 OR `osu_beatmaps`.`playmode`={0}) AND `osu_beatmap_difficulty_attribs`.`mode`={0} AND `approved` BETWEEN {1} AND {2} AND {3}{4}",
+		_gamemode, s_minRankedStatus, s_maxRankedStatus, condition, residentModsCondition()
+	));
+
+	std::unordered_map<s32, Beatmap> beatmaps;
+
+	while (res.NextRow())
+	{
+		s32 id = res[0];
+
+		auto beatmapIt = beatmaps.find(id);
+		if (beatmapIt == std::end(beatmaps))
+		{
+			beatmapIt = beatmaps.emplace(std::make_pair(id, id)).first;
+			beatmapIt->second.SetMode(_gamemode);
+		}
+
+		auto& beatmap = beatmapIt->second;
+
+		beatmap.SetRankedStatus(res[5]);
+		beatmap.SetScoreVersion(res[6]);
+		beatmap.SetNumHitCircles(res.IsNull(1) ? 0 : (s32)res[1]);
+		beatmap.SetNumSliders(res.IsNull(8) ? 0 : (s32)res[8]);
+		beatmap.SetNumSpinners(res.IsNull(7) ? 0 : (s32)res[7]);
+
+		s32 attribId = (s32)res[3];
+		if (attribId < _difficultyAttributes.size())
+			beatmap.SetDifficultyAttribute(res[2], _difficultyAttributes[attribId], res[4]);
+	}
+
+	return beatmaps;
+}
+
+void Processor::publishBeatmap(Beatmap beatmap)
+{
+	s32 id = beatmap.Id();
+
+	auto beatmapIt = _beatmaps.find(id);
+	if (beatmapIt == std::end(_beatmaps))
+		_beatmaps.emplace(id, std::move(beatmap));
+	else
+		beatmapIt->second = std::move(beatmap);
+
+	_unavailableBeatmapIds.erase(id);
+}
+
+std::string Processor::residentModsCondition() const
+{
+	if (_residentMods.empty())
+		return "";
+
+	std::vector<std::string> mods;
+	for (u32 m : _residentMods)
+		mods.emplace_back(std::to_string(m));
+
+	return StrFormat(" AND `osu_beatmap_difficulty_attribs`.`mods` IN ({0})", Join(mods, ","));
+}
+
+bool Processor::queryColdDifficulty(DatabaseConnection& dbSlave, const Beatmap& beatmap, EMods mods, Beatmap::attributes_t& attributes, RWLock* pLock)
+{
+	u32 relevantMods = MaskRelevantDifficultyMods(_gamemode, mods);
+	u64 key = ((u64)(u32)beatmap.Id() << 32) | relevantMods;
+
+	ColdDifficulty difficulty;
+	if (_pColdDifficulties->TryGet(key, difficulty))
+	{
+		_pDataDog->Increment("osu.pp.difficulty.cold_cache.hits", 1, {StrFormat("mode:{0}", GamemodeTag(_gamemode))}, 0.01f);
+		attributes = difficulty.Attributes;
+		return difficulty.Found;
+	}
+
+	_pDataDog->Increment("osu.pp.difficulty.cold_cache.misses", 1, {StrFormat("mode:{0}", GamemodeTag(_gamemode))}, 0.01f);
+
+	// Writers waiting for the beatmaps would otherwise hold up all other readers behind them until the query returns
+	if (pLock)
+		pLock->Unlock();
+
+	auto res = dbSlave.Query(StrFormat(
+		"SELECT `attrib_id`,`value` FROM `osu_beatmap_difficulty_attribs` WHERE `beatmap_id`={0} AND `mode`={1} AND `mods`={2}",
+		beatmap.Id(), _gamemode, relevantMods
+	));
+
+	difficulty.Found = res.NumRows() != 0;
+	difficulty.Attributes.fill(0.0f);
+
+	while (res.NextRow())
+	{
+		s32 attribId = (s32)res[0];
+		if (attribId >= 0 && (size_t)attribId < _difficultyAttributes.size())
+			difficulty.Attributes[_difficultyAttributes[attribId]] = res[1];
+	}
+
+	if (pLock)
+		pLock->Lock();
+
+	// Also remember combinations without any attributes such that they are not looked up again
+	_pColdDifficulties->Put(key, difficulty);
+
+	attributes = difficulty.Attributes;
+	return difficulty.Found;
+}
+
+const Beatmap& Processor::beatmapWithDifficulty(DatabaseConnection& dbSlave, const Beatmap& beatmap, EMods mods, Beatmap& coldBeatmap, RWLock* pLock)
+{
+	// Attributes of rarely played mod combinations are not resident. Compute from a copy with them filled in instead.
+	if (!_pColdDifficulties || beatmap.HasDifficulty(mods))
+		return beatmap;
+
+	// The given beatmap may be gone once the lock was released
+	coldBeatmap = beatmap.WithoutDifficulty();
+
+	Beatmap::attributes_t attributes;
+	if (queryColdDifficulty(dbSlave, coldBeatmap, mods, attributes, pLock))
+		coldBeatmap.SetDifficultyAttributes(mods, attributes);
+
+	return coldBeatmap;
+}
+
+void Processor::queryMissingBeatmapDifficulties(DatabaseConnection& dbSlave, const std::vector<ScoreRow>& scores)
+{
+	std::vector<s32> missingIds;
+
+	{
+		RWLock lock{&_beatmapMutex, false};
+
+		for (const auto& score : scores)
+		{
+			s32 id = score.BeatmapId;
+			if (_beatmaps.count(id) == 0 && _unavailableBeatmapIds.count(id) == 0 && _blacklistedBeatmapIds.count(id) == 0)
+				missingIds.emplace_back(id);
+		}
+	}
+
+	if (missingIds.empty())
+		return;
+
+	std::sort(std::begin(missingIds), std::end(missingIds));
+	missingIds.erase(std::unique(std::begin(missingIds), std::end(missingIds)), std::end(missingIds));
+
+	// Holds back the warmup until these are loaded
+	PriorityLock loadLock{&_beatmapLoadMutex, true};
+
+	for (size_t begin = 0; begin < missingIds.size(); begin += s_maxNumIdsPerQuery)
+	{
+		std::vector<std::string> ids;
+		for (size_t i = begin; i < std::min(begin + s_maxNumIdsPerQuery, missingIds.size()); ++i)
+			ids.emplace_back(std::to_string(missingIds[i]));
+
+		queryBeatmapDifficulties(dbSlave, StrFormat("`osu_beatmaps`.`beatmap_id` IN ({0})", Join(ids, ",")));
+	}
+
+	// Remember beatmaps without difficulty information (e.g. unranked ones), such that we don't look for them again
+	RWLock lock{&_beatmapMutex, true};
+
+	for (s32 id : missingIds)
+		if (_beatmaps.count(id) == 0)
+			_unavailableBeatmapIds.insert(id);
+}
+
 void Processor::pollAndProcessNewScores()
 {
 	static const s64 s_lastScoreIdUpdateStep = 100;
@@ -701,6 +2196,8 @@ void Processor::pollAndProcessNewScores()
 	UpdateBatch newUsers{_pDB, 0};  // We want the updates to occur immediately
 	UpdateBatch newScores{_pDB, 0}; // batches are used to conform the interface of processSingleUser
 
+	commitQueueCheckpointIfWritten();
+
 	// Obtain all new scores since the last poll and process them
 	auto res = _pDBSlave->Query(StrFormat(
 		"SELECT `score_id`,`user_id`,`pp`, `queue_id` "
@@ -715,14 +2212,15 @@ void Processor::pollAndProcessNewScores()
 
 	_pDataDog->Gauge("osu.pp.score.amount_behind_newest", res.NumRows(), {StrFormat("mode:{0}", GamemodeTag(_gamemode))});
 
-	while (res.NextRow())
+	// Stop intake right away when shutting down. Remaining scores stay in the queue.
+	while (!s_shallShutdown && res.NextRow())
 	{
 		s64 queueId = res[3];
 
 		if (res.IsNull(1))
 		{
 			// even though the score wasn't processed, we still want to mark the queue as completed.
-			_pDB->NonQuery(StrFormat("UPDATE `score_process_queue` SET `status` = 1 WHERE `queue_id` = {0}", queueId));
+			_pDB->NonQueryBackground(StrFormat("UPDATE `score_process_queue` SET `status` = 1 WHERE `queue_id` = {0}", queueId));
 			continue;
 		}
 
@@ -732,6 +2230,8 @@ void Processor::pollAndProcessNewScores()
 		_currentScoreId = std::max(_currentScoreId, scoreId);
 		_currentQueueId = std::max(_currentQueueId, queueId);
 
+		UserLock lock{this, userId};
+
 		User user = processSingleUser(
 			scoreId, // Only update the new score, old ones are caught by the background processor anyways
 			*_pDB,
@@ -751,7 +2251,7 @@ void Processor::pollAndProcessNewScores()
 			tlog::warning() << StrFormat("Could not find score ID {0} in result set.", scoreId);
 
 			// even though the score wasn't processed, we still want to mark the queue as completed.
-			_pDB->NonQuery(StrFormat("UPDATE `score_process_queue` SET `status` = 1 WHERE `queue_id` = {0}", queueId));
+			_pDB->NonQueryBackground(StrFormat("UPDATE `score_process_queue` SET `status` = 1 WHERE `queue_id` = {0}", queueId));
 
 			continue;
 		}
@@ -768,16 +2268,156 @@ void Processor::pollAndProcessNewScores()
 		{
 			storeCount(*_pDB, lastScoreIdKey(), _currentScoreId);
 			_numScoresProcessedSinceLastStore = 0;
+			_checkpointedQueueId = _currentQueueId;
 		}
 
+		size_t numPendingQueries = commitQueueCheckpointIfWritten();
+
 		_pDataDog->Increment("osu.pp.score.processed_new", 1, {StrFormat("mode:{0}", GamemodeTag(_gamemode))});
-		_pDataDog->Gauge("osu.pp.db.pending_queries", _pDB->NumPendingQueries(), {
+		_pDataDog->Gauge("osu.pp.db.pending_queries", numPendingQueries, {
 			StrFormat("mode:{0}", GamemodeTag(_gamemode)),
 			"connection:main",
 		});
 	}
 }
 
+size_t Processor::commitQueueCheckpointIfWritten()
+{
+	// Background writes are applied in order, hence the checkpoint is on the master once nothing
+	// is pending anymore, be it in the queue or in the journal. Waiting for this would stall
+	// processing while the master is unreachable, so the checkpoint is committed lazily instead.
+	size_t numPendingQueries = _pDB->NumPendingQueries();
+	if (numPendingQueries == 0)
+		_committedQueueId = _checkpointedQueueId;
+
+	return numPendingQueries;
+}
+
+void Processor::compactQueue()
+{
+	static const milliseconds s_idleInterval{10000};
+
+	auto pDB = newDBConnectionMaster();
+	auto pDBSlave = newDBConnectionSlave();
+
+	// Unknown until retrieved from the queue
+	s64 compactedQueueId = -1;
+
+	bool canMeasureReplicaLag = true;
+
+	auto sleep = [](milliseconds duration)
+	{
+		auto endTime = steady_clock::now() + duration;
+		while (!s_shallShutdown && steady_clock::now() < endTime)
+			std::this_thread::sleep_for(std::min(milliseconds{100}, duration));
+	};
+
+	while (!s_shallShutdown)
+	{
+		try
+		{
+			if (compactedQueueId < 0)
+			{
+				auto res = pDB->Query(StrFormat("SELECT MIN(`queue_id`) FROM `score_process_queue` WHERE `mode`={0}", static_cast<int>(_gamemode)));
+				compactedQueueId = res.NextRow() && !res.IsNull(0) ? (s64)res[0] - 1 : 0;
+
+				tlog::info() << StrFormat("Compacting processed queue entries after ID {0}.", compactedQueueId);
+			}
+
+			// Entries beyond the last checkpoint may still be looked at again after a restart
+			s64 endQueueId = std::min(compactedQueueId + _config.QueueCompactionBatchSize, (s64)_committedQueueId);
+			if (endQueueId <= compactedQueueId)
+			{
+				sleep(s_idleInterval);
+				continue;
+			}
+
+			if (canMeasureReplicaLag)
+			{
+				s64 lag = 0;
+				try
+				{
+					lag = replicaLag(*pDBSlave);
+				}
+				catch (const ProcessorException& e)
+				{
+					tlog::warning() << StrFormat("Can't measure replica lag: {0}. Compacting the queue without backing off.", e.Description());
+					canMeasureReplicaLag = false;
+				}
+				catch (const DatabaseException& e)
+				{
+					if (!e.IsAccessDenied())
+						throw;
+
+					tlog::warning() << StrFormat("Can't measure replica lag: {0}. Compacting the queue without backing off.", e.Description());
+					canMeasureReplicaLag = false;
+				}
+
+				// Stopped replication counts as lagging behind, as it most likely resumes with a backlog
+				if (lag < 0 || lag > _config.QueueCompactionMaxReplicaLag)
+				{
+					_pDataDog->Increment("osu.pp.queue.compaction_backoff", 1, {StrFormat("mode:{0}", GamemodeTag(_gamemode))});
+					sleep(s_idleInterval);
+					continue;
+				}
+			}
+
+			// Only acknowledged entries are removed, walking the primary key in small ranges
+			std::string condition = StrFormat(
+				"`queue_id`>{0} AND `queue_id`<={1} AND `mode`={2} AND `status`<>0",
+				compactedQueueId, endQueueId, static_cast<int>(_gamemode)
+			);
+
+			// Repeating both after a failure is harmless, since archiving ignores duplicates
+			if (!_config.QueueCompactionArchiveTable.empty())
+				pDB->NonQuery(StrFormat(
+					"INSERT IGNORE INTO `{0}` SELECT * FROM `score_process_queue` WHERE {1}",
+					_config.QueueCompactionArchiveTable, condition
+				));
+
+			pDB->NonQuery(StrFormat("DELETE FROM `score_process_queue` WHERE {0}", condition));
+			u32 numDeleted = pDB->AffectedRows();
+
+			compactedQueueId = endQueueId;
+
+			_pDataDog->Increment("osu.pp.queue.compacted", numDeleted, {StrFormat("mode:{0}", GamemodeTag(_gamemode))});
+
+			sleep(milliseconds{_config.QueueCompactionInterval});
+		}
+		catch (const DatabaseException& e)
+		{
+			tlog::warning() << StrFormat("Failed compacting the queue: {0}. Retrying.", e.Description());
+			sleep(s_idleInterval);
+
+			try
+			{
+				pDB->Reconnect();
+				pDBSlave->Reconnect();
+			}
+			catch (const DatabaseException& e)
+			{
+				tlog::warning() << StrFormat("Failed reconnecting: {0}", e.Description());
+			}
+		}
+	}
+
+	tlog::info() << StrFormat("Stopped compacting the queue after ID {0}.", compactedQueueId);
+}
+
+s64 Processor::replicaLag(DatabaseConnection& dbSlave)
+{
+	auto res = dbSlave.Query("SHOW SLAVE STATUS");
+	if (!res.NextRow())
+		return 0;
+
+	// Renamed in newer versions of MySQL
+	for (s32 i = 0; i < res.NumCols(); ++i)
+		if (res.ColumnName(i) == "Seconds_Behind_Master" || res.ColumnName(i) == "Seconds_Behind_Source")
+			return res.IsNull(i) ? -1 : (s64)res[i];
+
+	throw ProcessorException(SRC_POS, "Replica status lacks the lag behind the master.");
+}
+
 void Processor::pollAndProcessNewBeatmapSets(DatabaseConnection& dbSlave)
 {
 	_lastBeatmapSetPollTime = steady_clock::now();
@@ -794,20 +2434,127 @@ void Processor::pollAndProcessNewBeatmapSets(DatabaseConnection& dbSlave)
 
 	tlog::success() << StrFormat("Retrieved {0} new beatmaps.", res.NumRows());
 
+	UpdateBatch ppTables{_pDB, 10000};
+
 	while (res.NextRow())
 	{
+		s32 beatmapId = res[0];
+
 		_lastApprovedDate = (std::string)res[1];
-		queryBeatmapDifficulty(dbSlave, res[0]);
+		bool isLoaded = queryBeatmapDifficulty(dbSlave, beatmapId);
 
 		_pDataDog->Increment("osu.pp.difficulty.required_retrieval", 1, { StrFormat("mode:{0}", GamemodeTag(_gamemode)) });
+
+		if (!_config.PPTablesEnabled || !isLoaded)
+			continue;
+
+		computePPTable(dbSlave, ppTables, beatmapId);
+	}
+
+	ppTables.Flush();
+}
+
+void Processor::pollAndRefreshChangedBeatmaps(DatabaseConnection& dbSlave)
+{
+	// Inclusive, since more beatmaps may change within the same second after the previous poll.
+	// The ones refreshed already are skipped.
+	auto res = dbSlave.Query(StrFormat(
+		"SELECT `beatmap_id`,`{0}` FROM `osu_beatmaps` "
+		"WHERE `{0}` >= '{1}' AND (`playmode`=0 OR `playmode`={2}) "
+		"ORDER BY `{0}` ASC",
+		_config.BeatmapChangeColumn, _lastBeatmapChange, _gamemode
+	));
+
+	std::vector<s32> changedIds;
+	while (res.NextRow())
+	{
+		s32 id = res[0];
+		std::string change = (std::string)res[1];
+
+		if (change == _lastBeatmapChange)
+		{
+			if (!_lastBeatmapChangeIds.insert(id).second)
+				continue;
+		}
+		else
+		{
+			_lastBeatmapChange = change;
+			_lastBeatmapChangeIds = {id};
+		}
+
+		changedIds.emplace_back(id);
+	}
+
+	if (changedIds.empty())
+		return;
+
+	tlog::info() << StrFormat("Refreshing {0} changed beatmaps.", changedIds.size());
+
+	for (size_t begin = 0; begin < changedIds.size(); begin += s_maxNumIdsPerQuery)
+	{
+		std::vector<s32> chunkIds{
+			std::begin(changedIds) + begin,
+			std::begin(changedIds) + std::min(begin + s_maxNumIdsPerQuery, changedIds.size()),
+		};
+
+		refreshBeatmaps(dbSlave, chunkIds);
+	}
+}
+
+void Processor::refreshBeatmaps(DatabaseConnection& dbSlave, const std::vector<s32>& beatmapIds)
+{
+	std::vector<std::string> ids;
+	for (s32 id : beatmapIds)
+		ids.emplace_back(std::to_string(id));
+
+	// Loading takes long compared to publishing, hence it happens while readers carry on with the previous state
+	auto beatmaps = loadBeatmaps(dbSlave, StrFormat("`osu_beatmaps`.`beatmap_id` IN ({0})", Join(ids, ",")));
+
+	std::vector<std::string> removedIds;
+
+	{
+		RWLock lock{&_beatmapMutex, true};
+
+		_beatmapReplicas.clear();
+
+		for (s32 id : beatmapIds)
+		{
+			auto beatmapIt = beatmaps.find(id);
+			if (beatmapIt != std::end(beatmaps))
+				publishBeatmap(std::move(beatmapIt->second));
+			// Beatmaps which lost their ranked status or their attributes
+			else if (_beatmaps.erase(id) > 0)
+				removedIds.emplace_back(std::to_string(id));
+		}
 	}
+
+	// Cached attributes of other mods may have been recalculated, too
+	if (_pColdDifficulties)
+		_pColdDifficulties->Clear();
+
+	tlog::success() << StrFormat("Refreshed {0} beatmaps and removed {1}.", beatmaps.size(), removedIds.size());
+	_pDataDog->Increment("osu.pp.difficulty.refreshed", beatmaps.size(), {StrFormat("mode:{0}", GamemodeTag(_gamemode))});
+
+	if (!_config.PPTablesEnabled)
+		return;
+
+	UpdateBatch ppTables{_pDB, 10000};
+
+	if (!removedIds.empty())
+		ppTables.AppendAndCommit(StrFormat(
+			"DELETE FROM `{0}` WHERE `beatmap_id` IN ({1}) AND `mode`={2};",
+			_config.PPTablesTableName, Join(removedIds, ","), _gamemode
+		));
+
+	for (s32 id : beatmapIds)
+		computePPTable(dbSlave, ppTables, id);
 }
 
-void Processor::queryBeatmapBlacklist()
+void Processor::queryBeatmapBlacklist(DatabaseConnection& dbSlave)
 {
 	tlog::info() << "Retrieving blacklisted beatmaps.";
 
-	auto res = _pDBSlave->Query(StrFormat(
+	auto res = dbSlave.Query(StrFormat(
 		"SELECT `beatmap_id` "
 		"FROM `osu_beatmap_performance_blacklist` "
 		"WHERE `mode`={0}", _gamemode
@@ -855,25 +2602,107 @@ User Processor::processSingleUser(
 	s64 userId
 )
 {
+	auto scores = queryScores(dbSlave, StrFormat("`user_id`={0}", userId));
+	return processSingleUser(selectedScoreId, db, dbSlave, newUsers, newScores, userId, scores[userId]);
+}
+
+User Processor::processSingleUser(
+	s64 selectedScoreId,
+	DatabaseConnection& db,
+	DatabaseConnection& dbSlave,
+	UpdateBatch& newUsers,
+	UpdateBatch& newScores,
+	s64 userId,
+	const std::vector<ScoreRow>& scores
+)
+{
+	if (_lazyBeatmaps)
+		queryMissingBeatmapDifficulties(dbSlave, scores);
+
 	switch (_gamemode)
 	{
 	case EGamemode::Osu:
-		return processSingleUserGeneric<OsuScore>(selectedScoreId, db, dbSlave, newUsers, newScores, userId);
+		return processSingleUserGeneric<OsuScore>(selectedScoreId, db, dbSlave, newUsers, newScores, userId, scores);
 
 	case EGamemode::Taiko:
-		return processSingleUserGeneric<TaikoScore>(selectedScoreId, db, dbSlave, newUsers, newScores, userId);
+		return processSingleUserGeneric<TaikoScore>(selectedScoreId, db, dbSlave, newUsers, newScores, userId, scores);
 
 	case EGamemode::Catch:
-		return processSingleUserGeneric<CatchScore>(selectedScoreId, db, dbSlave, newUsers, newScores, userId);
+		return processSingleUserGeneric<CatchScore>(selectedScoreId, db, dbSlave, newUsers, newScores, userId, scores);
 
 	case EGamemode::Mania:
-		return processSingleUserGeneric<ManiaScore>(selectedScoreId, db, dbSlave, newUsers, newScores, userId);
+		return processSingleUserGeneric<ManiaScore>(selectedScoreId, db, dbSlave, newUsers, newScores, userId, scores);
 
 	default:
 		throw ProcessorException(SRC_POS, StrFormat("Unknown gamemode requested. ({0})", _gamemode));
 	}
 }
 
+std::unordered_map<s64, std::vector<Processor::ScoreRow>> Processor::queryScores(DatabaseConnection& dbSlave, const std::string& condition)
+{
+	PhaseProfiler::Scope profile{_pProfiler.get(), PhaseProfiler::EPhase::Fetch};
+
+	// The stats and metadata of each user are joined in rather than queried per user
+	auto res = dbSlave.Query(StrFormat(
+		"SELECT "
+		"`s`.`score_id`,"
+		"`user_id`,"
+		"`s`.`beatmap_id`,"
+		"`s`.`score`,"
+		"`s`.`maxcombo`,"
+		"`s`.`count300`,"
+		"`s`.`count100`,"
+		"`s`.`count50`,"
+		"`s`.`countmiss`,"
+		"`s`.`countgeki`,"
+		"`s`.`countkatu`,"
+		"`s`.`enabled_mods`,"
+		"`s`.`pp`,"
+		"{2} "
+		"FROM `osu_scores{0}_high` AS `s` "
+		"LEFT JOIN `osu_user_stats{0}` AS `stats` USING(`user_id`) "
+		"LEFT JOIN `{3}` AS `meta` USING(`user_id`) "
+		"WHERE {1}",
+		GamemodeSuffix(_gamemode),
+		condition,
+		inactiveOrRestrictedCondition("`stats`.`last_played`", "`meta`.`user_warnings`"),
+		_config.UserMetadataTableName
+	));
+
+	profile.Switch(PhaseProfiler::EPhase::Parse);
+
+	std::unordered_map<s64, std::vector<ScoreRow>> scores;
+
+	while (res.NextRow())
+	{
+		ScoreRow score;
+
+		score.ScoreId = res[0];
+		score.UserId = res[1];
+		score.BeatmapId = res[2];
+		score.Score = res[3];
+		score.MaxCombo = res[4];
+		score.Num300 = res[5];
+		score.Num100 = res[6];
+		score.Num50 = res[7];
+		score.NumMiss = res[8];
+		score.NumGeki = res[9];
+		score.NumKatu = res[10];
+		score.Mods = res[11];
+
+		// Column 12 is the pp value of the score from the database.
+		score.HasPP = !res.IsNull(12);
+		score.PP = score.HasPP ? (f32)res[12] : 0.0f;
+
+		// Users without stats or metadata are treated as active
+		score.IsUserUnranked = !res.IsNull(13) && (s32)res[13] != 0;
+
+		scores[score.UserId].emplace_back(score);
+	}
+
+	return scores;
+}
+
 template <class TScore>
 User Processor::processSingleUserGeneric(
 	s64 selectedScoreId,
@@ -881,53 +2710,42 @@ User Processor::processSingleUserGeneric(
 	DatabaseConnection& dbSlave,
 	UpdateBatch& newUsers,
 	UpdateBatch& newScores,
-	s64 userId
+	s64 userId,
+	const std::vector<ScoreRow>& scores
 )
 {
 	static const f32 s_notableEventRatingThreshold = 1.0f / 21.5f;
 	static const f32 s_notableEventRatingDifferenceMinimum = 5.0f;
 
-	auto res = dbSlave.Query(StrFormat(
-		"SELECT "
-		"`score_id`,"
-		"`user_id`,"
-		"`beatmap_id`,"
-		"`score`,"
-		"`maxcombo`,"
-		"`count300`,"
-		"`count100`,"
-		"`count50`,"
-		"`countmiss`,"
-		"`countgeki`,"
-		"`countkatu`,"
-		"`enabled_mods`,"
-		"`pp` "
-		"FROM `osu_scores{0}_high` "
-		"WHERE `user_id`={1}", GamemodeSuffix(_gamemode), userId
-	));
-
 	User user{userId};
 	std::vector<TScore> scoresThatNeedDBUpdate;
 
+	auto pComparison = _pFormulaComparison ? _pFormulaComparison->BeginUser(userId) : nullptr;
+
+	PhaseProfiler::Scope profile{_pProfiler.get(), PhaseProfiler::EPhase::Compute};
+	if (_pProfiler)
+		_pProfiler->AddScores(scores.size());
+
 	{
 		RWLock lock{&_beatmapMutex, false};
+		const auto* pBeatmaps = &localBeatmaps();
 
 		// Process the data we got
-		while (res.NextRow())
+		for (const auto& row : scores)
 		{
-			s64 scoreId = res[0];
-			s32 beatmapId = res[2];
+			s64 scoreId = row.ScoreId;
+			s32 beatmapId = row.BeatmapId;
 
-			EMods mods = res[11];
+			EMods mods = row.Mods;
 
 			// Blacklisted maps don't count
 			if (_blacklistedBeatmapIds.count(beatmapId) > 0)
 				continue;
 
-			auto beatmapIt = _beatmaps.find(beatmapId);
+			auto beatmapIt = pBeatmaps->find(beatmapId);
 
 			// We don't want to look at scores on beatmaps we have no information about
-			if (beatmapIt == std::end(_beatmaps))
+			if (beatmapIt == std::end(*pBeatmaps))
 			{
 				// If we couldn't find the beatmap of the _selected score_
 				// we should probably re-check in the DB whether the beatmap recently appeared.
@@ -940,47 +2758,70 @@ User Processor::processSingleUserGeneric(
 					lock.Unlock();
 					queryBeatmapDifficulty(dbSlave, beatmapId);
 					lock.Lock();
-					beatmapIt = _beatmaps.find(beatmapId);
+					pBeatmaps = &localBeatmaps();
+					beatmapIt = pBeatmaps->find(beatmapId);
 
 					// If after querying we still didn't find anything, then we can just leave it.
-					if (beatmapIt == std::end(_beatmaps))
+					if (beatmapIt == std::end(*pBeatmaps))
 						continue;
 				}
 
 				continue;
 			}
 
-			const auto& beatmap = beatmapIt->second;
+			const Beatmap* pBeatmap = &beatmapIt->second;
 
-			s32 rankedStatus = beatmap.RankedStatus();
+			s32 rankedStatus = pBeatmap->RankedStatus();
 			if (rankedStatus < s_minRankedStatus || rankedStatus > s_maxRankedStatus)
 				continue;
 
+			Beatmap coldBeatmap{beatmapId};
+			const auto& beatmap = beatmapWithDifficulty(dbSlave, *pBeatmap, mods, coldBeatmap, &lock);
+
+			// The lock may have been released in the meantime
+			pBeatmaps = &localBeatmaps();
+
 			TScore score = TScore{
 				scoreId,
 				_gamemode,
-				res[1], // user_id
+				row.UserId,
 				beatmapId,
-				res[3], // score
-				res[4], // maxcombo
-				res[5], // Num300
-				res[6], // Num100
-				res[7], // Num50
-				res[8], // NumMiss
-				res[9], // NumGeki
-				res[10], // NumKatu
+				row.Score,
+				row.MaxCombo,
+				row.Num300,
+				row.Num100,
+				row.Num50,
+				row.NumMiss,
+				row.NumGeki,
+				row.NumKatu,
 				mods,
 				beatmap,
 			};
 
 			user.AddScorePPRecord(score.CreatePPRecord());
 
-			// Column 12 is the pp value of the score from the database.
+			if (pComparison)
+				pComparison->AddScore(
+					score.TotalValue(),
+					scoreId,
+					beatmapId,
+					row.Score,
+					row.MaxCombo,
+					row.Num300,
+					row.Num100,
+					row.Num50,
+					row.NumMiss,
+					row.NumGeki,
+					row.NumKatu,
+					mods,
+					beatmap
+				);
+
 			// Only update score if it differs a lot!
 
 			// always write selected scores to ensure the queue is updated.
 			// TODO: properly use queue_id or return a bool asserting whether we performed an update, rather than doing this.
-			if (res.IsNull(12) || (_config.WriteAllPPChanges && fabs((f32)res[12] - score.TotalValue()) > 0.001f) || selectedScoreId == scoreId)
+			if (!row.HasPP || (_config.WriteAllPPChanges && fabs(row.PP - score.TotalValue()) > 0.001f) || selectedScoreId == scoreId)
 			{
 				// Ensure the selected score is in the front if it exists
 				if (selectedScoreId == scoreId)
@@ -991,6 +2832,8 @@ User Processor::processSingleUserGeneric(
 		}
 	}
 
+	profile.Switch(PhaseProfiler::EPhase::Write);
+
 	{
 		std::lock_guard<std::mutex> lock{newScores.Mutex()};
 
@@ -1000,9 +2843,24 @@ User Processor::processSingleUserGeneric(
 
 	_pDataDog->Increment("osu.pp.score.updated", scoresThatNeedDBUpdate.size(), {StrFormat("mode:{0}", GamemodeTag(_gamemode))}, 0.01f);
 
+	profile.Switch(PhaseProfiler::EPhase::Aggregate);
+
 	user.ComputePPRecord();
 	auto userPPRecord = user.GetPPRecord();
 
+	if (pComparison)
+		_pFormulaComparison->EndUser(*pComparison, userPPRecord.Value);
+
+	// The index has to agree with the update below, which stores 0pp for inactive or restricted users.
+	// Users without scores have 0pp either way.
+	if (_pRankIndex)
+	{
+		bool isUnranked = !scores.empty() && scores.front().IsUserUnranked;
+		_pRankIndex->Update(userId, isUnranked ? 0 : userPPRecord.Value, selectedScoreId != 0);
+	}
+
+	profile.Switch(PhaseProfiler::EPhase::Write);
+
 	// Check for notable event
 	if (!scoresThatNeedDBUpdate.empty() && scoresThatNeedDBUpdate.front().Id() == selectedScoreId && // Did the score actually get found (this _should_ never be false, but better make sure)
 		scoresThatNeedDBUpdate.front().TotalValue() > userPPRecord.Value * s_notableEventRatingThreshold)
@@ -1032,14 +2890,17 @@ User Processor::processSingleUserGeneric(
 
 			tlog::info() << StrFormat("Notable event: s{0} u{1} b{2}", score.Id(), userId, score.BeatmapId());
 
+			s64 rank = _pRankIndex ? _pRankIndex->Rank(userId) : 0;
+
 			db.NonQueryBackground(StrFormat(
 				"INSERT INTO "
 				"osu_user_performance_change(user_id, mode, beatmap_id, performance_change, `rank`) "
-				"VALUES({0},{1},{2},{3},null)",
+				"VALUES({0},{1},{2},{3},{4})",
 				userId,
 				_gamemode,
 				score.BeatmapId(),
-				ratingChange
+				ratingChange,
+				rank > 0 ? std::to_string(rank) : "null"
 			));
 		}
 	}
@@ -1048,7 +2909,7 @@ User Processor::processSingleUserGeneric(
 		"UPDATE `osu_user_stats{0}` "
 		"SET `{1}`= CASE "
 			// Set pp to 0 if the user is inactive or restricted.
-			"WHEN (CURDATE() > DATE_ADD(`last_played`, INTERVAL 3 MONTH) OR (SELECT `user_warnings` FROM `{5}` WHERE `user_id`={4}) > 0) THEN 0 "
+			"WHEN {5} THEN 0 "
 			"ELSE {2} "
 		"END,"
 		"`accuracy_new`={3} "
@@ -1058,7 +2919,7 @@ User Processor::processSingleUserGeneric(
 		userPPRecord.Value,
 		userPPRecord.Accuracy,
 		userId,
-		_config.UserMetadataTableName
+		inactiveOrRestrictedCondition("`last_played`", StrFormat("(SELECT `user_warnings` FROM `{0}` WHERE `user_id`={1})", _config.UserMetadataTableName, userId))
 	));
 
 	_pDataDog->Increment("osu.pp.user.amount_processed", 1, {StrFormat("mode:{0}", GamemodeTag(_gamemode))}, 0.01f);
@@ -1066,6 +2927,208 @@ User Processor::processSingleUserGeneric(
 	return user;
 }
 
+void Processor::createPPTable(DatabaseConnection& db)
+{
+	db.NonQuery(StrFormat(
+		"CREATE TABLE IF NOT EXISTS `{0}`("
+			"`beatmap_id` MEDIUMINT UNSIGNED NOT NULL,"
+			"`mode` TINYINT UNSIGNED NOT NULL,"
+			"`mods` INT UNSIGNED NOT NULL,"
+			"`accuracy` DECIMAL(5,2) NOT NULL,"
+			"`misses` SMALLINT UNSIGNED NOT NULL,"
+			"`pp` FLOAT NOT NULL,"
+			"PRIMARY KEY(`beatmap_id`,`mode`,`mods`,`accuracy`,`misses`)"
+		")",
+		_config.PPTablesTableName
+	));
+}
+
+void Processor::computePPTable(DatabaseConnection& dbSlave, UpdateBatch& ppTables, s32 beatmapId)
+{
+	if (_blacklistedBeatmapIds.count(beatmapId) > 0)
+		return;
+
+	// Computed from a copy, such that cold attributes can be queried without holding the lock
+	Beatmap beatmap{beatmapId};
+	{
+		RWLock lock{&_beatmapMutex, false};
+		const auto& beatmaps = localBeatmaps();
+
+		auto beatmapIt = beatmaps.find(beatmapId);
+		if (beatmapIt == std::end(beatmaps))
+			return;
+
+		beatmap = beatmapIt->second;
+	}
+
+	if (beatmap.RankedStatus() < s_minRankedStatus || beatmap.RankedStatus() > s_maxRankedStatus)
+		return;
+
+	switch (_gamemode)
+	{
+	case EGamemode::Osu:
+		return computePPTableGeneric<OsuScore>(dbSlave, ppTables, beatmap);
+
+	case EGamemode::Taiko:
+		return computePPTableGeneric<TaikoScore>(dbSlave, ppTables, beatmap);
+
+	case EGamemode::Catch:
+		return computePPTableGeneric<CatchScore>(dbSlave, ppTables, beatmap);
+
+	case EGamemode::Mania:
+		return computePPTableGeneric<ManiaScore>(dbSlave, ppTables, beatmap);
+
+	default:
+		throw ProcessorException(SRC_POS, StrFormat("Unknown gamemode requested. ({0})", _gamemode));
+	}
+}
+
+namespace
+{
+	struct HypotheticalHits
+	{
+		s32 MaxCombo;
+		s32 Num300;
+		s32 Num100;
+		s32 Num50;
+		s32 NumGeki;
+		s32 NumKatu;
+	};
+
+	// Hit counts of a full-combo-but-for-misses play approximately reaching the given accuracy
+	bool hypotheticalHits(EGamemode mode, const Beatmap& beatmap, EMods mods, f64 accuracy, s32 numMiss, HypotheticalHits& hits)
+	{
+		hits = HypotheticalHits{0, 0, 0, 0, 0, 0};
+
+		s32 maxCombo = (s32)beatmap.DifficultyAttribute(mods, Beatmap::MaxCombo);
+
+		// Judgements which are no misses are split between the best and second best one
+		auto splitHits = [accuracy](s32 numTotal, s32 numHit, f64 weight, s32& numBest, s32& numSecond)
+		{
+			numSecond = Clamp((s32)std::round(weight * (numHit - accuracy * numTotal)), 0, numHit);
+			numBest = numHit - numSecond;
+		};
+
+		switch (mode)
+		{
+		case EGamemode::Osu:
+		{
+			s32 numTotal = beatmap.NumHitCircles() + beatmap.NumSliders() + beatmap.NumSpinners();
+			if (numMiss > numTotal)
+				return false;
+
+			splitHits(numTotal, numTotal - numMiss, 1.5, hits.Num300, hits.Num100);
+			hits.MaxCombo = std::max(maxCombo - numMiss, 0);
+			return true;
+		}
+
+		case EGamemode::Taiko:
+		{
+			// Every hit object adds to the combo
+			s32 numTotal = maxCombo;
+			if (numMiss > numTotal)
+				return false;
+
+			splitHits(numTotal, numTotal - numMiss, 2, hits.Num300, hits.Num100);
+			hits.MaxCombo = numTotal - numMiss;
+			return true;
+		}
+
+		case EGamemode::Catch:
+		{
+			// Misses are fruits. Missed droplets are counted as katu without breaking the combo.
+			s32 numCaught = maxCombo - numMiss;
+			if (numCaught < 0 || accuracy <= 0)
+				return false;
+
+			hits.Num300 = numCaught;
+			hits.NumKatu = std::max((s32)std::round(numCaught / accuracy) - numCaught - numMiss, 0);
+			hits.MaxCombo = numCaught;
+			return true;
+		}
+
+		case EGamemode::Mania:
+		{
+			s32 numTotal = beatmap.NumHitCircles() + beatmap.NumSliders();
+			if (numMiss > numTotal)
+				return false;
+
+			splitHits(numTotal, numTotal - numMiss, 1.5, hits.NumGeki, hits.Num100);
+			hits.MaxCombo = std::max(maxCombo - numMiss, 0);
+			return true;
+		}
+
+		default:
+			return false;
+		}
+	}
+}
+
+template <class TScore>
+void Processor::computePPTableGeneric(DatabaseConnection& dbSlave, UpdateBatch& ppTables, const Beatmap& beatmap)
+{
+	static const s32 s_maxScore = 1000000;
+
+	// Grid points whose accuracy can't be reached with the amount of misses are left out
+	static const f64 s_maxAccuracyDeviation = 0.005;
+
+	std::vector<std::string> rows;
+
+	for (EMods mods : _ppTableMods)
+	{
+		Beatmap coldBeatmap{beatmap.Id()};
+		const auto& beatmapWithMods = beatmapWithDifficulty(dbSlave, beatmap, mods, coldBeatmap, nullptr);
+
+		// Without attributes, all pp would come out as 0
+		if (!beatmapWithMods.HasDifficulty(mods))
+			continue;
+
+		for (s32 numMiss : _ppTableMisses)
+		{
+			for (f64 accuracy : _ppTableAccuracies)
+			{
+				HypotheticalHits hits;
+				if (!hypotheticalHits(_gamemode, beatmapWithMods, mods, accuracy, numMiss, hits))
+					continue;
+
+				TScore score = TScore{
+					0,
+					_gamemode,
+					0,
+					beatmap.Id(),
+					s_maxScore,
+					hits.MaxCombo,
+					hits.Num300,
+					hits.Num100,
+					hits.Num50,
+					numMiss,
+					hits.NumGeki,
+					hits.NumKatu,
+					mods,
+					beatmapWithMods,
+				};
+
+				if (std::abs(score.Accuracy() - accuracy) > s_maxAccuracyDeviation)
+					continue;
+
+				rows.emplace_back(StrFormat(
+					"({0},{1},{2},{3},{4},{5})",
+					beatmap.Id(), _gamemode, (u32)mods, accuracy * 100, numMiss, score.TotalValue()
+				));
+			}
+		}
+	}
+
+	if (rows.empty())
+		return;
+
+	std::lock_guard<std::mutex> lock{ppTables.Mutex()};
+	ppTables.AppendAndCommitNonThreadsafe(StrFormat(
+		"REPLACE INTO `{0}`(`beatmap_id`,`mode`,`mods`,`accuracy`,`misses`,`pp`) VALUES {1};",
+		_config.PPTablesTableName, Join(rows, ",")
+	));
+}
+
 void Processor::storeCount(DatabaseConnection& db, std::string key, s64 value)
 {
 	db.NonQueryBackground(StrFormat(
@@ -1088,31 +3151,72 @@ s64 Processor::retrieveCount(DatabaseConnection& db, std::string key)
 	throw ProcessorException{SRC_POS, StrFormat("Unable to retrieve count '{0}'.", key)};
 }
 
-std::string Processor::retrieveUserName(s64 userId, DatabaseConnection& db) const
+std::unordered_map<s64, std::string> Processor::retrieveUserNames(const std::vector<s64>& userIds, DatabaseConnection& db) const
 {
-	auto res = db.Query(StrFormat(
-		"SELECT `username` FROM `{0}` WHERE `user_id`='{1}'",
-		_config.UserMetadataTableName, userId
-	));
+	std::unordered_map<s64, std::string> result;
+	for (s64 userId : userIds)
+		result[userId] = "<not-found>";
+
+	std::vector<std::string> ids;
+	for (const auto& entry : result)
+		ids.emplace_back(std::to_string(entry.first));
 
-	if (!res.NextRow() || res.IsNull(0))
-		return "<not-found>";
+	for (size_t begin = 0; begin < ids.size(); begin += s_maxNumIdsPerQuery)
+	{
+		std::vector<std::string> chunk{
+			std::begin(ids) + begin,
+			std::begin(ids) + std::min(begin + s_maxNumIdsPerQuery, ids.size())
+		};
+
+		auto res = db.Query(StrFormat(
+			"SELECT `user_id`,`username` FROM `{0}` WHERE `user_id` IN ({1})",
+			_config.UserMetadataTableName, Join(chunk, ",")
+		));
+
+		while (res.NextRow())
+			if (!res.IsNull(1))
+				result[res[0]] = (std::string)res[1];
+	}
 
-	return res[0];
+	return result;
 }
 
-std::string Processor::retrieveBeatmapName(s32 beatmapId, DatabaseConnection& db) const
+std::unordered_map<s32, std::string> Processor::retrieveBeatmapNames(const std::vector<s32>& beatmapIds, DatabaseConnection& db) const
 {
-	auto res = db.Query(StrFormat("SELECT `filename` FROM `osu_beatmaps` WHERE `beatmap_id`='{0}'", beatmapId));
+	std::unordered_map<s32, std::string> result;
+	for (s32 beatmapId : beatmapIds)
+		result[beatmapId] = "<not-found>";
+
+	std::vector<std::string> ids;
+	for (const auto& entry : result)
+		ids.emplace_back(std::to_string(entry.first));
+
+	for (size_t begin = 0; begin < ids.size(); begin += s_maxNumIdsPerQuery)
+	{
+		std::vector<std::string> chunk{
+			std::begin(ids) + begin,
+			std::begin(ids) + std::min(begin + s_maxNumIdsPerQuery, ids.size())
+		};
+
+		auto res = db.Query(StrFormat(
+			"SELECT `beatmap_id`,`filename` FROM `osu_beatmaps` WHERE `beatmap_id` IN ({0})",
+			Join(chunk, ",")
+		));
+
+		while (res.NextRow())
+		{
+			if (res.IsNull(1))
+				continue;
 
-	if (!res.NextRow() || res.IsNull(0))
-		return "<not-found>";
+			std::string name = res[1];
 
-	std::string result = res[0];
+			// Strip trailing ".osu"
+			if (name.size() > 4)
+				name = name.substr(0, name.size()-4);
 
-	// Strip trailing ".osu"
-	if (result.size() > 4)
-		result = result.substr(0, result.size()-4);
+			result[res[0]] = name;
+		}
+	}
 
 	return result;
 }
@@ -0,0 +1,129 @@
+#include <pp/Common.h>
+#include <pp/performance/RankIndex.h>
+
+#include <algorithm>
+#include <cmath>
+
+PP_NAMESPACE_BEGIN
+
+// Anybody above is ranked as if they had exactly this much
+const f64 RankIndex::s_maxPP = 50000;
+const f64 RankIndex::s_bucketsPerPP = 100;
+
+RankIndex::RankIndex()
+: _tree((size_t)(s_maxPP * s_bucketsPerPP) + 1, 0)
+{
+}
+
+void RankIndex::Update(s64 userId, f64 pp, bool insertIfMissing)
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+
+	auto userIt = _userBuckets.find(userId);
+	bool isRanked = userIt != std::end(_userBuckets);
+
+	if (!isRanked && !insertIfMissing)
+		return;
+
+	// Bucket 0 is never counted, users without pp have no rank
+	u32 newBucket = bucket(pp);
+
+	if (isRanked)
+	{
+		if (userIt->second == newBucket)
+			return;
+
+		add(userIt->second, -1);
+
+		if (newBucket == 0)
+		{
+			_userBuckets.erase(userIt);
+			return;
+		}
+
+		userIt->second = newBucket;
+	}
+	else
+	{
+		if (newBucket == 0)
+			return;
+
+		_userBuckets.emplace(userId, newBucket);
+	}
+
+	add(newBucket, 1);
+}
+
+s64 RankIndex::Rank(s64 userId) const
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+
+	auto userIt = _userBuckets.find(userId);
+	if (userIt == std::end(_userBuckets))
+		return 0;
+
+	// One more than the amount of users with strictly more pp
+	return 1 + _numUsers - numAtOrBelow(userIt->second);
+}
+
+size_t RankIndex::NumUsers() const
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+	return _userBuckets.size();
+}
+
+std::vector<std::pair<s64, s64>> RankIndex::Ranks() const
+{
+	std::vector<std::pair<s64, u32>> userBuckets;
+
+	{
+		std::lock_guard<std::mutex> lock{_mutex};
+		userBuckets.assign(std::begin(_userBuckets), std::end(_userBuckets));
+	}
+
+	std::sort(std::begin(userBuckets), std::end(userBuckets), [](const std::pair<s64, u32>& a, const std::pair<s64, u32>& b)
+	{
+		return a.second != b.second ? a.second > b.second : a.first < b.first;
+	});
+
+	std::vector<std::pair<s64, s64>> ranks;
+	ranks.reserve(userBuckets.size());
+
+	for (size_t i = 0; i < userBuckets.size(); ++i)
+	{
+		// Ties share the rank of the first user in their bucket
+		s64 rank = i > 0 && userBuckets[i].second == userBuckets[i - 1].second ? ranks.back().second : (s64)i + 1;
+		ranks.emplace_back(userBuckets[i].first, rank);
+	}
+
+	return ranks;
+}
+
+u32 RankIndex::bucket(f64 pp)
+{
+	if (!(pp > 0))
+		return 0;
+
+	// Round up such that any positive amount of pp is ranked
+	return (u32)std::ceil(std::min(pp, s_maxPP) * s_bucketsPerPP);
+}
+
+void RankIndex::add(u32 bucket, s32 delta)
+{
+	_numUsers += delta;
+
+	// The tree is 1-based, bucket 0 is never stored
+	for (size_t i = bucket; i < _tree.size(); i += i & (~i + 1))
+		_tree[i] += delta;
+}
+
+s64 RankIndex::numAtOrBelow(u32 bucket) const
+{
+	s64 result = 0;
+	for (size_t i = bucket; i > 0; i -= i & (~i + 1))
+		result += _tree[i];
+
+	return result;
+}
+
+PP_NAMESPACE_END
@@ -56,7 +56,9 @@ int main(s32 argc, char* argv[])
 		args::Command newCommand(commands, "new", "Continually poll for new scores and compute pp of these", [&](args::Subparser& parser)
 		{
 			parser.Parse();
-			Processor processor{ToGamemode(args::get(modePositional)), args::get(configFlag)};
+
+			// Beatmaps are loaded once monitoring started, such that new scores don't have to wait for them
+			Processor processor{ToGamemode(args::get(modePositional)), args::get(configFlag), true};
 			processor.MonitorNewScores();
 		});
 
@@ -79,12 +81,28 @@ int main(s32 argc, char* argv[])
 				1,
 			};
 
+			args::ValueFlag<u32> processesFlag{
+				parser,
+				"PROCESSES",
+				"Number of worker processes, each with its own threads and connections, sharing the beatmaps. "
+				"Crashed workers are restarted. Continuing requires the same number of processes.\n"
+				"Default: 1 (no worker processes)",
+				{'p', "processes"},
+				1,
+			};
+
 			parser.Parse();
 
 			u32 numThreads = args::get(threadsFlag);
+			u32 numProcesses = args::get(processesFlag);
 
 			Processor processor{ToGamemode(args::get(modePositional)), args::get(configFlag)};
-			processor.ProcessAllUsers(!continueFlag, numThreads);
+
+			// Workers are forked once the beatmaps are loaded, and share them
+			if (numProcesses > 1)
+				processor.ProcessAllUsersInWorkers(!continueFlag, numProcesses, numThreads);
+			else
+				processor.ProcessAllUsers(!continueFlag, numThreads);
 		});
 
 		args::Command sqlCommand(commands, "sql", "Compute pp of users given by a SQL select statement", [&](args::Subparser &parser) {
@@ -94,6 +112,13 @@ int main(s32 argc, char* argv[])
 				"The SQL statement selecting the user ids to compute.",
 			};
 
+			args::Flag continueFlag{
+				parser,
+				"CONTINUE",
+				"Continue where a previously aborted run of the same statement left off.",
+				{'c', "continue"},
+			};
+
 			args::ValueFlag<u32> threadsFlag{
 				parser,
 				"THREADS",
@@ -110,7 +135,7 @@ int main(s32 argc, char* argv[])
 			u32 numThreads = args::get(threadsFlag);
 
 			Processor processor{ToGamemode(args::get(modePositional)), args::get(configFlag)};
-			processor.ProcessSQL(numThreads, sqlString);
+			processor.ProcessSQL(!continueFlag, numThreads, sqlString);
 		});
 
 		args::Command usersCommand(commands, "users", "Compute pp of specific users", [&](args::Subparser &parser) {
@@ -120,10 +145,21 @@ int main(s32 argc, char* argv[])
 				"Users to recompute pp for.",
 			};
 
+			args::ValueFlag<u32> threadsFlag{
+				parser,
+				"THREADS",
+				"Number of threads to use. Can be useful even if the processor itself has no "
+				"parallelism due to additional connections to the database.\n"
+				"Default: 1",
+				{'t', "threads"},
+				1,
+			};
+
 			parser.Parse();
 
-			Processor processor{ToGamemode(args::get(modePositional)), args::get(configFlag)};
-			processor.ProcessUsers(args::get(usersPositional));
+			// Only a handful of beatmaps are needed, hence loading all of them up front would take needlessly long
+			Processor processor{ToGamemode(args::get(modePositional)), args::get(configFlag), true};
+			processor.ProcessUsers(args::get(usersPositional), args::get(threadsFlag));
 		});
 
 		args::Command scoresCommand(commands, "scores", "Compute pp of specific scores", [&](args::Subparser& parser)
@@ -134,10 +170,182 @@ int main(s32 argc, char* argv[])
 				"Score IDs to recompute pp for.",
 			};
 
+			args::ValueFlag<u32> threadsFlag{
+				parser,
+				"THREADS",
+				"Number of threads to use. Can be useful even if the processor itself has no "
+				"parallelism due to additional connections to the database.\n"
+				"Default: 1",
+				{'t', "threads"},
+				1,
+			};
+
+			parser.Parse();
+
+			// Only a handful of beatmaps are needed, hence loading all of them up front would take needlessly long
+			Processor processor{ToGamemode(args::get(modePositional)), args::get(configFlag), true};
+			processor.ProcessScores(args::get(scoresPositional), args::get(threadsFlag));
+		});
+
+		args::Command captureCommand(commands, "capture", "Record arrivals of new scores into a trace for later replay", [&](args::Subparser& parser)
+		{
+			args::Positional<std::string> tracePositional{
+				parser,
+				"trace",
+				"The file to record the trace into.",
+			};
+
+			args::ValueFlag<u32> durationFlag{
+				parser,
+				"DURATION",
+				"Number of seconds to record for. 0 records until interrupted.\n"
+				"Default: 0",
+				{'d', "duration"},
+				0,
+			};
+
+			parser.Parse();
+
+			Processor processor{ToGamemode(args::get(modePositional)), args::get(configFlag), true};
+			processor.CaptureLoad(args::get(tracePositional), args::get(durationFlag));
+		});
+
+		args::Command replayCommand(commands, "replay", "Replay a recorded trace into the master database and measure how fast it is processed by 'new'", [&](args::Subparser& parser)
+		{
+			args::Positional<std::string> tracePositional{
+				parser,
+				"trace",
+				"The trace to replay.",
+			};
+
+			args::ValueFlag<f64> speedFlag{
+				parser,
+				"SPEED",
+				"Multiple of the recorded speed to replay at. 0 replays as fast as possible.\n"
+				"Default: 1",
+				{'s', "speed"},
+				1,
+			};
+
+			parser.Parse();
+
+			Processor processor{ToGamemode(args::get(modePositional)), args::get(configFlag), true};
+			processor.ReplayLoad(args::get(tracePositional), args::get(speedFlag));
+		});
+
+		args::Command generateCommand(commands, "generate", "Fill the master database with synthetic beatmaps, users and scores for benchmarking", [&](args::Subparser& parser)
+		{
+			args::ValueFlag<s64> usersFlag{
+				parser,
+				"USERS",
+				"Number of users to generate.\n"
+				"Default: 100000",
+				{'u', "users"},
+				100000,
+			};
+
+			args::ValueFlag<s32> beatmapsFlag{
+				parser,
+				"BEATMAPS",
+				"Number of beatmaps to generate.\n"
+				"Default: 10000",
+				{'b', "beatmaps"},
+				10000,
+			};
+
+			args::ValueFlag<f64> scoresFlag{
+				parser,
+				"SCORES",
+				"Average number of scores per user.\n"
+				"Default: 100",
+				{'s', "scores"},
+				100,
+			};
+
+			args::ValueFlag<u32> seedFlag{
+				parser,
+				"SEED",
+				"Seed of the random number generators.\n"
+				"Default: 0",
+				{"seed"},
+				0,
+			};
+
+			args::Flag truncateFlag{
+				parser,
+				"TRUNCATE",
+				"Remove all existing rows from the generated tables first.",
+				{"truncate"},
+			};
+
+			args::ValueFlag<u32> threadsFlag{
+				parser,
+				"THREADS",
+				"Number of threads, each with its own database connection, to generate users with.\n"
+				"Default: 1",
+				{'t', "threads"},
+				1,
+			};
+
+			parser.Parse();
+
+			DatasetGenerator::Parameters parameters;
+			parameters.NumUsers = args::get(usersFlag);
+			parameters.NumBeatmaps = args::get(beatmapsFlag);
+			parameters.MeanScoresPerUser = args::get(scoresFlag);
+			parameters.Seed = args::get(seedFlag);
+			parameters.Truncate = truncateFlag;
+
+			Processor processor{ToGamemode(args::get(modePositional)), args::get(configFlag), true};
+			processor.GenerateDataset(parameters, args::get(threadsFlag));
+		});
+
+		args::Command ranksCommand(commands, "ranks", "Export the global rank of every user as CSV", [&](args::Subparser& parser)
+		{
+			args::Positional<std::string> filePositional{
+				parser,
+				"file",
+				"The file to write the ranks into.",
+			};
+
+			parser.Parse();
+
+			Processor processor{ToGamemode(args::get(modePositional)), args::get(configFlag), true};
+			processor.ExportRanks(args::get(filePositional));
+		});
+
+		args::Command backfillCommand(commands, "backfill", "Compute pp of users with scores lacking pp, continuing where the last backfill stopped", [&](args::Subparser& parser)
+		{
+			args::ValueFlag<u32> threadsFlag{
+				parser,
+				"THREADS",
+				"Number of threads to use.\n"
+				"Default: 1",
+				{'t', "threads"},
+				1,
+			};
+
+			parser.Parse();
+
+			Processor processor{ToGamemode(args::get(modePositional)), args::get(configFlag)};
+			processor.BackfillNullPP(args::get(threadsFlag));
+		});
+
+		args::Command ppTablesCommand(commands, "pp-tables", "Compute pp tables of all ranked beatmaps for the configured mods, accuracies and misses", [&](args::Subparser& parser)
+		{
+			args::ValueFlag<u32> threadsFlag{
+				parser,
+				"THREADS",
+				"Number of threads to use.\n"
+				"Default: 1",
+				{'t', "threads"},
+				1,
+			};
+
 			parser.Parse();
 
 			Processor processor{ToGamemode(args::get(modePositional)), args::get(configFlag)};
-			processor.ProcessScores(args::get(scoresPositional));
+			processor.ComputePPTables(args::get(threadsFlag));
 		});
 
 		args::GlobalOptions argumentsGlobal{parser, argumentsGroup};
@@ -27,7 +27,7 @@ std::unique_ptr<Active> Active::Create()
 size_t Active::NumPending() const
 {
 	checkForAndThrowException();
-	return _tasks.Size();
+	return _numPending;
 }
 
 bool Active::IsBusy() const
@@ -47,8 +47,11 @@ void Active::run()
 	try
 	{
 		while (!_isDone)
+		{
 			// Wait for a task, pop it and execute it. Hence the double ()()
 			_tasks.WaitAndPop()();
+			--_numPending;
+		}
 	}
 	catch (...)
 	{
@@ -62,6 +65,7 @@ void Active::send(std::function<void()> callback, bool checkForException)
 	if (checkForException)
 		checkForAndThrowException();
 
+	++_numPending;
 	_tasks.Push(callback);
 }
 
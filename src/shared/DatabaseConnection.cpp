@@ -3,8 +3,48 @@
 
 #include <mysql.h>
 
+#include <mutex>
+
 PP_NAMESPACE_BEGIN
 
+bool DatabaseException::IsTransient() const
+{
+	// Rather than listing the many ways of losing the master, e.g. during a failover, only errors
+	// of the query itself are known to fail again. Everything else is worth retrying.
+	switch (_errorCode)
+	{
+	case 1048: // Column can not be null
+	case 1054: // Unknown column
+	case 1062: // Duplicate entry for key
+	case 1064: // Syntax error
+	case 1136: // Column count doesn't match value count
+	case 1146: // Table doesn't exist
+	case 1264: // Out of range value
+	case 1292: // Incorrect value
+	case 1366: // Incorrect value for column
+	case 1406: // Data too long for column
+	case 1451: // Foreign key constraint on delete or update
+	case 1452: // Foreign key constraint on insert or update
+		return false;
+	default:
+		return true;
+	}
+}
+
+bool DatabaseException::IsAccessDenied() const
+{
+	switch (_errorCode)
+	{
+	case 1044: // Access denied to database
+	case 1142: // Command denied on table
+	case 1143: // Command denied on column
+	case 1227: // Lacking a privilege such as SUPER or REPLICATION CLIENT
+		return true;
+	default:
+		return false;
+	}
+}
+
 DatabaseConnection::DatabaseConnection(
 	std::string host,
 	s32 port,
@@ -13,6 +53,10 @@ DatabaseConnection::DatabaseConnection(
 	std::string database
 ) : _host{std::move(host)}, _port{port}, _username{std::move(username)}, _password{std::move(password)}, _database{std::move(database)}
 {
+	// mysql_init initializes the library implicitly, which is not thread safe. Connections may be opened concurrently.
+	static std::once_flag s_libraryInitFlag;
+	std::call_once(s_libraryInitFlag, []() { mysql_library_init(0, nullptr, nullptr); });
+
 	if (!mysql_init(&_mySQL))
 		throw DatabaseException(SRC_POS, StrFormat("MySQL struct could not be initialized. ({0})", Error()));
 
@@ -30,6 +74,10 @@ DatabaseConnection::DatabaseConnection(DatabaseConnection&& other)
 
 DatabaseConnection& DatabaseConnection::operator=(DatabaseConnection&& other)
 {
+	// The journal refers to its connection and can therefore not be moved along.
+	if (other._pJournal)
+		throw DatabaseException(SRC_POS, "Journaled connections can not be moved.");
+
 	if (!other._pActive || other._pActive->IsBusy())
 	{
 		// Deconstruct the previous connection's active object
@@ -56,7 +104,8 @@ DatabaseConnection& DatabaseConnection::operator=(DatabaseConnection&& other)
 
 DatabaseConnection::~DatabaseConnection()
 {
-	// Destruct our active object before closing the mysql connection.
+	// Destruct our journal and active object before closing the mysql connection.
+	_pJournal = nullptr;
 	_pActive = nullptr;
 	if (_isInitialized)
 		mysql_close(&_mySQL);
@@ -66,11 +115,22 @@ void DatabaseConnection::connect()
 {
 	mysql_close(&_mySQL);
 	if (!mysql_real_connect(&_mySQL, _host.c_str(), _username.c_str(), _password.c_str(), _database.c_str(), _port, nullptr, CLIENT_MULTI_STATEMENTS))
-		throw DatabaseException(SRC_POS, StrFormat("Could not connect. ({0})", Error()));
+		throw DatabaseException(SRC_POS, StrFormat("Could not connect. ({0})", Error()), mysql_errno(&_mySQL));
+}
+
+void DatabaseConnection::EnableJournal(const std::string& filename, const std::string& markerKey)
+{
+	_pJournal = std::make_unique<Journal>(*this, filename, markerKey);
 }
 
 void DatabaseConnection::NonQueryBackground(const std::string& queryString)
 {
+	if (_pJournal)
+	{
+		_pJournal->Append(queryString);
+		return;
+	}
+
 	// We arbitrarily decide, that we don't want to have more than 1000 pending queries
 	while (NumPendingQueries() > 1000)
 		// Avoid to have the processor "spinning" at full power if there is no work to do in Update()
@@ -85,7 +145,7 @@ void DatabaseConnection::NonQuery(const std::string& queryString)
 	std::lock_guard<std::recursive_mutex> lock{_dbMutex};
 
 	if (mysql_query(&_mySQL, queryString.c_str()) != 0)
-		throw DatabaseException(SRC_POS, StrFormat("Error executing query {0}. ({1})", queryString, Error()));
+		throw DatabaseException(SRC_POS, StrFormat("Error executing query {0}. ({1})", queryString, Error()), mysql_errno(&_mySQL));
 
 	s32 status;
 	do
@@ -94,12 +154,12 @@ void DatabaseConnection::NonQuery(const std::string& queryString)
 		if (pRes != nullptr)
 			mysql_free_result(pRes);
 		else if (mysql_field_count(&_mySQL) != 0)
-			throw DatabaseException(SRC_POS, StrFormat("Error getting result. ({0})", Error()));
+			throw DatabaseException(SRC_POS, StrFormat("Error getting result. ({0})", Error()), mysql_errno(&_mySQL));
 
 		/* more results? -1 = no, >0 = error, 0 = yes (keep looping) */
 		status = mysql_next_result(&_mySQL);
 		if (status > 0)
-			throw DatabaseException(SRC_POS, StrFormat("Error executing query {0}. ({1})", queryString, Error()));
+			throw DatabaseException(SRC_POS, StrFormat("Error executing query {0}. ({1})", queryString, Error()), mysql_errno(&_mySQL));
 	}
 	while (status == 0);
 }
@@ -110,15 +170,40 @@ QueryResult DatabaseConnection::Query(const std::string& queryString)
 	std::lock_guard<std::recursive_mutex> lock{_dbMutex};
 
 	if (mysql_query(&_mySQL, queryString.c_str()) != 0)
-		throw DatabaseException(SRC_POS, StrFormat("Error executing query {0}. ({1})", queryString, Error()));
+		throw DatabaseException(SRC_POS, StrFormat("Error executing query {0}. ({1})", queryString, Error()), mysql_errno(&_mySQL));
 
 	MYSQL_RES* pRes = mysql_store_result(&_mySQL);
 	if (pRes == nullptr)
-		throw DatabaseException(SRC_POS, StrFormat("Error getting result. ({0})", Error()));
+		throw DatabaseException(SRC_POS, StrFormat("Error getting result. ({0})", Error()), mysql_errno(&_mySQL));
 
 	return QueryResult{pRes};
 }
 
+QueryResult DatabaseConnection::QueryStreaming(const std::string& queryString)
+{
+	// We don't want concurrent queries
+	std::lock_guard<std::recursive_mutex> lock{_dbMutex};
+
+	if (mysql_query(&_mySQL, queryString.c_str()) != 0)
+		throw DatabaseException(SRC_POS, StrFormat("Error executing query {0}. ({1})", queryString, Error()), mysql_errno(&_mySQL));
+
+	MYSQL_RES* pRes = mysql_use_result(&_mySQL);
+	if (pRes == nullptr)
+		throw DatabaseException(SRC_POS, StrFormat("Error getting result. ({0})", Error()), mysql_errno(&_mySQL));
+
+	return QueryResult{pRes};
+}
+
+std::string DatabaseConnection::Escape(const std::string& str)
+{
+	std::lock_guard<std::recursive_mutex> lock{_dbMutex};
+
+	// Worst case every character is escaped, plus the terminating null character
+	std::string result(2 * str.size() + 1, '\0');
+	result.resize(mysql_real_escape_string(&_mySQL, &result[0], str.c_str(), (unsigned long)str.size()));
+	return result;
+}
+
 const char *DatabaseConnection::Error()
 {
 	// We don't want concurrent queries
@@ -126,6 +211,17 @@ const char *DatabaseConnection::Error()
 	return mysql_error(&_mySQL);
 }
 
+size_t DatabaseConnection::NumPendingQueries() const
+{
+	return _pActive->NumPending() + (_pJournal ? _pJournal->NumPending() : 0);
+}
+
+void DatabaseConnection::Reconnect()
+{
+	std::lock_guard<std::recursive_mutex> lock{_dbMutex};
+	connect();
+}
+
 u32 DatabaseConnection::AffectedRows()
 {
 	// We don't want concurrent queries
@@ -0,0 +1,389 @@
+#include <pp/Common.h>
+#include <pp/shared/DatabaseConnection.h>
+#include <pp/shared/Journal.h>
+
+#include <algorithm>
+
+#ifdef _WIN32
+	#include <io.h>
+#else
+	#include <unistd.h>
+#endif
+
+using namespace std::chrono;
+
+PP_NAMESPACE_BEGIN
+
+namespace
+{
+	// Once fully replayed, the journal file is truncated when it grew larger than this.
+	const s64 s_truncateThreshold = 16 * 1024 * 1024;
+
+	// Guard against reading garbage as the size of a record.
+	const u32 s_maxRecordSize = 1024 * 1024 * 1024;
+
+	const milliseconds s_minRetryDelay{100};
+	const milliseconds s_maxRetryDelay{30000};
+
+	bool seek(FILE* pFile, s64 offset)
+	{
+#ifdef _WIN32
+		return _fseeki64(pFile, offset, SEEK_SET) == 0;
+#else
+		return fseeko(pFile, (off_t)offset, SEEK_SET) == 0;
+#endif
+	}
+
+	// Flushes the stream and makes sure the data reached the disk, such that it survives losing power
+	bool sync(FILE* pFile)
+	{
+		if (fflush(pFile) != 0)
+			return false;
+
+#if defined(_WIN32)
+		return _commit(_fileno(pFile)) == 0;
+#elif defined(__APPLE__)
+		return fsync(fileno(pFile)) == 0;
+#else
+		return fdatasync(fileno(pFile)) == 0;
+#endif
+	}
+
+	// FNV-1a over the sequence number and the query. Allows detecting records
+	// which were only partially written before a crash.
+	u32 checksum(u64 sequence, const std::string& query)
+	{
+		u32 hash = 2166136261u;
+		auto add = [&hash](byte b)
+		{
+			hash ^= b;
+			hash *= 16777619u;
+		};
+
+		for (size_t i = 0; i < sizeof(sequence); ++i)
+			add((byte)(sequence >> (8 * i)));
+
+		for (char c : query)
+			add((byte)c);
+
+		return hash;
+	}
+
+	s64 recordSize(const std::string& query)
+	{
+		return (s64)(sizeof(u64) + 2 * sizeof(u32) + query.size());
+	}
+}
+
+Journal::Journal(DatabaseConnection& db, std::string filename, std::string markerKey)
+: _db(db), _filename{std::move(filename)}, _markerKey{std::move(markerKey)}
+{
+	recover();
+
+	_thread = std::thread(&Journal::run, this);
+}
+
+Journal::~Journal()
+{
+	{
+		std::lock_guard<std::mutex> lock{_mutex};
+		_shallShutdown = true;
+	}
+
+	_recordCondition.notify_all();
+
+	if (_thread.joinable())
+		_thread.join();
+
+	if (_numPending > 0)
+		tlog::warning() << StrFormat("Left {0} unreplayed records in journal '{1}'.", (size_t)_numPending, _filename);
+
+	if (_pWriteFile)
+		fclose(_pWriteFile);
+	if (_pReadFile)
+		fclose(_pReadFile);
+}
+
+void Journal::Append(const std::string& queryString)
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+
+	if (std::exception_ptr exception = _journalException)
+		std::rethrow_exception(exception);
+
+	u64 sequence = _nextSequence;
+	u32 size = (u32)queryString.size();
+	u32 sum = checksum(sequence, queryString);
+
+	// Always write at the end of the last complete record. A previously failed append is overwritten this way.
+	bool success =
+		seek(_pWriteFile, _writeOffset) &&
+		fwrite(&sequence, sizeof(sequence), 1, _pWriteFile) == 1 &&
+		fwrite(&size, sizeof(size), 1, _pWriteFile) == 1 &&
+		fwrite(&sum, sizeof(sum), 1, _pWriteFile) == 1 &&
+		(size == 0 || fwrite(queryString.data(), size, 1, _pWriteFile) == 1) &&
+		sync(_pWriteFile);
+
+	if (!success)
+		throw JournalException{SRC_POS, StrFormat("Could not append to journal '{0}'.", _filename)};
+
+	++_nextSequence;
+	_writeOffset += recordSize(queryString);
+	++_numPending;
+
+	_recordCondition.notify_one();
+}
+
+size_t Journal::NumPending()
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+
+	if (std::exception_ptr exception = _journalException)
+		std::rethrow_exception(exception);
+
+	return _numPending;
+}
+
+void Journal::run()
+{
+	try
+	{
+		replayAll();
+	}
+	catch (...)
+	{
+		std::lock_guard<std::mutex> lock{_mutex};
+		_journalException = std::current_exception();
+	}
+}
+
+void Journal::replayAll()
+{
+	Record record;
+
+	while (true)
+	{
+		s64 offset;
+
+		{
+			std::unique_lock<std::mutex> lock{_mutex};
+
+			while (_readOffset >= _writeOffset && !_shallShutdown)
+				_recordCondition.wait(lock);
+
+			// Even when shutting down we want to drain what's left.
+			if (_readOffset >= _writeOffset)
+				break;
+
+			offset = _readOffset;
+		}
+
+		// Subsequent records can't be found anymore. Failing makes appending and waiting for pending records throw
+		// rather than waiting forever.
+		if (!seek(_pReadFile, offset) || !readRecord(_pReadFile, record))
+			throw JournalException{SRC_POS, StrFormat("Corrupted record at offset {0} of journal '{1}'.", offset, _filename)};
+
+		try
+		{
+			replay(record);
+		}
+		catch (const DatabaseException&)
+		{
+			// The master is unavailable and we are shutting down. Leave the remaining records
+			// on disk; they will be replayed the next time this journal is opened.
+			break;
+		}
+
+		std::lock_guard<std::mutex> lock{_mutex};
+
+		_readOffset = offset + recordSize(record.Query);
+		--_numPending;
+
+		truncateIfDrained();
+	}
+}
+
+void Journal::recover()
+{
+	_marker = retrieveMarker();
+
+	FILE* pFile = fopen(_filename.c_str(), "rb");
+	bool exists = pFile != nullptr;
+
+	if (exists)
+	{
+		Record record;
+		u64 expectedSequence = 0;
+
+		// Only consider the longest prefix of consecutive, intact records.
+		while (readRecord(pFile, record) && (expectedSequence == 0 || record.Sequence == expectedSequence))
+		{
+			expectedSequence = record.Sequence + 1;
+			_writeOffset += recordSize(record.Query);
+			++_numPending;
+		}
+
+		fclose(pFile);
+
+		_nextSequence = std::max(expectedSequence, (u64)(_marker + 1));
+	}
+	else
+		_nextSequence = (u64)(_marker + 1);
+
+	_pWriteFile = fopen(_filename.c_str(), exists ? "r+b" : "w+b");
+	if (!_pWriteFile)
+		throw JournalException{SRC_POS, StrFormat("Could not open journal '{0}' for writing.", _filename)};
+
+	_pReadFile = fopen(_filename.c_str(), "rb");
+	if (!_pReadFile)
+		throw JournalException{SRC_POS, StrFormat("Could not open journal '{0}' for reading.", _filename)};
+
+	if (_numPending > 0)
+		tlog::info() << StrFormat("Journal '{0}' contains {1} records from a previous run.", _filename, (size_t)_numPending);
+}
+
+bool Journal::readRecord(FILE* pFile, Record& record)
+{
+	u32 size;
+	u32 sum;
+
+	if (fread(&record.Sequence, sizeof(record.Sequence), 1, pFile) != 1 ||
+		fread(&size, sizeof(size), 1, pFile) != 1 ||
+		fread(&sum, sizeof(sum), 1, pFile) != 1 ||
+		size > s_maxRecordSize)
+		return false;
+
+	record.Query.resize(size);
+	if (size > 0 && fread(&record.Query[0], size, 1, pFile) != 1)
+		return false;
+
+	return checksum(record.Sequence, record.Query) == sum;
+}
+
+void Journal::replay(const Record& record)
+{
+	milliseconds retryDelay = s_minRetryDelay;
+
+	// Records that can never succeed only advance the marker past themselves
+	bool isDeadLetter = false;
+
+	while (true)
+	{
+		std::string error;
+		bool isTransient = true;
+
+		try
+		{
+			// Records up to the marker have already been committed
+			if ((s64)record.Sequence <= _marker)
+				return;
+
+			// Each record commits atomically together with its sequence number. A later
+			// replay of the same record is thereby skipped by the check above.
+			bool isTerminated = isDeadLetter || (!record.Query.empty() && record.Query.back() == ';');
+			_db.NonQuery(StrFormat(
+				"START TRANSACTION;"
+				"{0}{1}"
+				"INSERT INTO `osu_counts`(`name`,`count`) VALUES('{2}',{3}) "
+				"ON DUPLICATE KEY UPDATE `name`=VALUES(`name`),`count`=VALUES(`count`);"
+				"COMMIT;",
+				isDeadLetter ? "" : record.Query, isTerminated ? "" : ";", _markerKey, record.Sequence
+			));
+
+			_marker = (s64)record.Sequence;
+			return;
+		}
+		catch (const DatabaseException& e)
+		{
+			if (_shallShutdown)
+				throw;
+
+			error = e.Description();
+			isTransient = isDeadLetter || e.IsTransient();
+		}
+
+		if (isTransient)
+		{
+			tlog::warning() << StrFormat(
+				"Could not replay record {0} of journal '{1}'. Retrying in {2}ms. ({3})",
+				record.Sequence, _filename, (s64)retryDelay.count(), error
+			);
+
+			std::this_thread::sleep_for(retryDelay);
+			retryDelay = std::min(retryDelay * 2, s_maxRetryDelay);
+		}
+		else
+		{
+			tlog::error() << StrFormat(
+				"Record {0} of journal '{1}' can not be replayed. Moving it to '{2}'. ({3})",
+				record.Sequence, _filename, deadLetterFilename(), error
+			);
+
+			writeDeadLetter(record, error);
+			isDeadLetter = true;
+		}
+
+		try
+		{
+			// The failed transaction was rolled back by closing the connection. It may still have
+			// committed right before the connection was lost, hence we need to refresh the marker.
+			_db.Reconnect();
+			_marker = retrieveMarker();
+		}
+		catch (const DatabaseException&)
+		{
+		}
+	}
+}
+
+std::string Journal::deadLetterFilename() const
+{
+	return _filename + ".dead";
+}
+
+void Journal::writeDeadLetter(const Record& record, const std::string& error)
+{
+	FILE* pFile = fopen(deadLetterFilename().c_str(), "ab");
+	if (!pFile)
+		throw JournalException{SRC_POS, StrFormat("Could not open dead letters '{0}' of journal '{1}'.", deadLetterFilename(), _filename)};
+
+	// Human readable, such that the records can be fixed up and applied by hand
+	std::string entry = StrFormat("-- Record {0}: {1}\n{2}\n", record.Sequence, error, record.Query);
+	bool isWritten = fwrite(entry.data(), entry.size(), 1, pFile) == 1 && sync(pFile);
+	fclose(pFile);
+
+	if (!isWritten)
+		throw JournalException{SRC_POS, StrFormat("Could not write dead letters '{0}' of journal '{1}'.", deadLetterFilename(), _filename)};
+}
+
+void Journal::truncateIfDrained()
+{
+	if (_readOffset < _writeOffset || _writeOffset < s_truncateThreshold)
+		return;
+
+	fclose(_pWriteFile);
+	fclose(_pReadFile);
+
+	_pWriteFile = fopen(_filename.c_str(), "w+b");
+	_pReadFile = fopen(_filename.c_str(), "rb");
+
+	if (!_pWriteFile || !_pReadFile)
+		throw JournalException{SRC_POS, StrFormat("Could not truncate journal '{0}'.", _filename)};
+
+	_readOffset = _writeOffset = 0;
+}
+
+s64 Journal::retrieveMarker()
+{
+	auto res = _db.Query(StrFormat(
+		"SELECT `count` FROM `osu_counts` WHERE `name`='{0}'", _markerKey
+	));
+
+	while (res.NextRow())
+		if (!res.IsNull(0))
+			return res[0];
+
+	return 0;
+}
+
+PP_NAMESPACE_END
@@ -0,0 +1,112 @@
+#include <pp/Common.h>
+#include <pp/shared/Numa.h>
+
+#include <algorithm>
+#include <fstream>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+PP_NAMESPACE_BEGIN
+
+namespace
+{
+	thread_local s32 s_currentNumaNode = -1;
+
+	// Parses lists such as "0-7,16-23"
+	std::vector<u32> parseCpuList(const std::string& cpuList)
+	{
+		std::vector<u32> cpus;
+
+		for (const auto& range : Split(cpuList, ","))
+		{
+			if (range.empty())
+				continue;
+
+			size_t dash = range.find('-');
+
+			u32 first = (u32)std::stoul(range.substr(0, dash));
+			u32 last = dash == std::string::npos ? first : (u32)std::stoul(range.substr(dash + 1));
+
+			for (u32 cpu = first; cpu <= last; ++cpu)
+				cpus.emplace_back(cpu);
+		}
+
+		// Split yields the ranges back to front
+		std::sort(std::begin(cpus), std::end(cpus));
+		return cpus;
+	}
+}
+
+NumaTopology NumaTopology::Detect()
+{
+	NumaTopology topology;
+
+#ifdef __linux__
+	for (u32 node = 0; ; ++node)
+	{
+		std::ifstream file{StrFormat("/sys/devices/system/node/node{0}/cpulist", node)};
+		if (!file)
+			break;
+
+		std::string cpuList;
+		std::getline(file, cpuList);
+
+		auto cpus = parseCpuList(cpuList);
+
+		// Memory-only nodes can't run workers
+		if (!cpus.empty())
+			topology._nodeCpus.emplace_back(std::move(cpus));
+	}
+#endif
+
+	if (topology._nodeCpus.empty())
+	{
+		topology._nodeCpus.emplace_back();
+		for (u32 cpu = 0; cpu < std::max(std::thread::hardware_concurrency(), 1u); ++cpu)
+			topology._nodeCpus.back().emplace_back(cpu);
+	}
+
+	return topology;
+}
+
+u32 NumaTopology::NodeOfWorker(u32 worker) const
+{
+	return worker % (u32)_nodeCpus.size();
+}
+
+u32 NumaTopology::CpuOfWorker(u32 worker) const
+{
+	const auto& cpus = _nodeCpus[NodeOfWorker(worker)];
+	return cpus[(worker / (u32)_nodeCpus.size()) % cpus.size()];
+}
+
+bool PinCurrentThread(const std::vector<u32>& cpus)
+{
+#ifdef __linux__
+	cpu_set_t cpuSet;
+	CPU_ZERO(&cpuSet);
+
+	for (u32 cpu : cpus)
+		CPU_SET(cpu, &cpuSet);
+
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0;
+#else
+	return false;
+#endif
+}
+
+s32 CurrentNumaNode()
+{
+	return s_currentNumaNode;
+}
+
+void SetCurrentNumaNode(s32 node)
+{
+	s_currentNumaNode = node;
+}
+
+PP_NAMESPACE_END
@@ -0,0 +1,118 @@
+#include <pp/Common.h>
+#include <pp/shared/PerfCounters.h>
+
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+PP_NAMESPACE_BEGIN
+
+const char* PerfCounters::EventName(EEvent event)
+{
+	switch (event)
+	{
+	case Cycles:          return "cycles";
+	case Instructions:    return "instructions";
+	case CacheMisses:     return "cache misses";
+	case TLBMisses:       return "TLB misses";
+	case BranchMisses:    return "branch misses";
+	case TaskClock:       return "task clock";
+	case PageFaults:      return "page faults";
+	case ContextSwitches: return "context switches";
+	default:              return "unknown";
+	}
+}
+
+PerfCounters::PerfCounters()
+{
+	_fds.fill(-1);
+	_groupIndices.fill(-1);
+
+#ifdef __linux__
+	// The leader is a software event, such that the group exists even if no hardware event does
+	open(TaskClock, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+	if (_groupFd < 0)
+		return;
+
+	open(Cycles,       PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	open(Instructions, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	open(CacheMisses,  PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	open(BranchMisses, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+	open(TLBMisses,    PERF_TYPE_HW_CACHE,
+		PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+	);
+
+	open(PageFaults,      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+	open(ContextSwitches, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES);
+#endif
+}
+
+PerfCounters::~PerfCounters()
+{
+#ifdef __linux__
+	for (s32 fd : _fds)
+		if (fd >= 0)
+			close(fd);
+#endif
+}
+
+void PerfCounters::open(EEvent event, u32 type, u64 config)
+{
+#ifdef __linux__
+	perf_event_attr attr = {};
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	// Only our own code is of interest, and unprivileged users may not count the kernel anyway
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	// The calling thread on any CPU
+	s32 fd = (s32)syscall(__NR_perf_event_open, &attr, 0, -1, _groupFd, 0);
+	if (fd < 0)
+		return;
+
+	if (_groupFd < 0)
+		_groupFd = fd;
+
+	_fds[event] = fd;
+	_groupIndices[event] = (s32)_numOpen++;
+#endif
+}
+
+PerfCounters::values_t PerfCounters::Read() const
+{
+	values_t values;
+	values.fill(0);
+
+#ifdef __linux__
+	if (_groupFd < 0)
+		return values;
+
+	// Number of events, time enabled, time running, followed by the value of each event
+	std::vector<u64> buffer(3 + _numOpen);
+	if (read(_groupFd, buffer.data(), buffer.size() * sizeof(u64)) != (ssize_t)(buffer.size() * sizeof(u64)))
+		return values;
+
+	u64 timeEnabled = buffer[1];
+	u64 timeRunning = buffer[2];
+	if (timeRunning == 0)
+		return values;
+
+	f64 scale = (f64)timeEnabled / timeRunning;
+
+	for (u32 event = 0; event < NumEvents; ++event)
+		if (_groupIndices[event] >= 0)
+			values[event] = (u64)(buffer[3 + _groupIndices[event]] * scale);
+#endif
+
+	return values;
+}
+
+PP_NAMESPACE_END
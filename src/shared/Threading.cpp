@@ -109,6 +109,12 @@ ThreadPool::ThreadPool()
 }
 
 ThreadPool::ThreadPool(const u32 numThreads)
+: ThreadPool{numThreads, nullptr}
+{
+}
+
+ThreadPool::ThreadPool(const u32 numThreads, std::function<void(u32)> threadInitializer)
+: _threadInitializer{std::move(threadInitializer)}
 {
 	StartThreads(numThreads);
 }
@@ -121,13 +127,22 @@ ThreadPool::~ThreadPool()
 
 void ThreadPool::StartThreads(const u32 num)
 {
-	_numThreads += num;
+	{
+		// Workers compare their index against this while holding the lock
+		std::lock_guard<std::mutex> lock{_taskQueueMutex};
+
+		_numThreads += num;
+	}
+
 	for (u32 i = (u32)_threads.size(); i < _numThreads; ++i)
 	{
 		_threads.emplace_back([this, i]
 		{
 			tlog::debug() << StrFormat("Worker thread {0} started.", i);
 
+			if (_threadInitializer)
+				_threadInitializer(i);
+
 			while (true)
 			{
 				std::unique_lock<std::mutex> lock{_taskQueueMutex};
@@ -199,30 +214,34 @@ void ThreadPool::WaitUntilFinished()
 {
 	std::unique_lock<std::mutex> lock{_systemBusyMutex};
 
-	if (_numTasksInSystem == 0)
-		return;
-
-	_systemBusyCondition.wait(lock);
+	// Guard against spurious wakeups
+	while (_numTasksInSystem != 0)
+		_systemBusyCondition.wait(lock);
 }
 
 void ThreadPool::WaitUntilFinishedFor(const std::chrono::microseconds Duration)
 {
 	std::unique_lock<std::mutex> lock{_systemBusyMutex};
 
-	if (_numTasksInSystem == 0)
-		return;
-
-	_systemBusyCondition.wait_for(lock, Duration);
+	_systemBusyCondition.wait_for(lock, Duration, [this]() { return _numTasksInSystem == 0; });
 }
 
 void ThreadPool::FlushQueue()
 {
-	std::lock_guard<std::mutex> lock{_taskQueueMutex};
+	{
+		std::lock_guard<std::mutex> lock{_taskQueueMutex};
 
-	_numTasksInSystem -= (u32)_taskQueue.size();
+		_numTasksInSystem -= (u32)_taskQueue.size();
 
-	// Clear the task queue
-	_taskQueue.clear();
+		// Clear the task queue
+		_taskQueue.clear();
+	}
+
+	// No task may be left to wake up those waiting for the system to become idle
+	std::unique_lock<std::mutex> lock{_systemBusyMutex};
+
+	if (_numTasksInSystem == 0)
+		_systemBusyCondition.notify_all();
 }
 
 PP_NAMESPACE_END
@@ -52,6 +52,17 @@ void UpdateBatch::AppendAndCommitNonThreadsafe(const std::string& values)
 	}
 }
 
+void UpdateBatch::Flush()
+{
+	std::lock_guard<std::mutex> lock{_batchMutex};
+
+	if (_empty)
+		return;
+
+	execute();
+	reset();
+}
+
 void UpdateBatch::reset()
 {
 	_query = "";//"START TRANSACTION;";
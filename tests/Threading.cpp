@@ -0,0 +1,617 @@
+#include <pp/Common.h>
+#include <pp/shared/Active.h>
+#include <pp/shared/SharedQueue.h>
+#include <pp/shared/Threading.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono;
+
+PP_NAMESPACE_BEGIN
+
+DEFINE_EXCEPTION(TestException);
+
+namespace
+{
+	// Generous enough for slow CI machines, yet well below the timeout of ctest
+	const seconds s_deadline{60};
+
+	const u32 s_numThreads = std::max(std::thread::hardware_concurrency(), 4u);
+
+	void check(bool condition, const std::string& description)
+	{
+		if (!condition)
+			throw TestException{SRC_POS, StrFormat("Check failed: {0}", description)};
+	}
+
+	// Runs the given step on its own thread. A lost wakeup would block forever, hence the whole
+	// test fails once the deadline passed, without waiting for the blocked thread.
+	void withinDeadline(const std::string& name, std::function<void()> step)
+	{
+		auto result = std::async(std::launch::async, step);
+		if (result.wait_for(s_deadline) == std::future_status::timeout)
+		{
+			tlog::error() << StrFormat("'{0}' did not finish within {1}s. A wakeup was likely lost.", name, (s64)s_deadline.count());
+			std::_Exit(1);
+		}
+
+		result.get();
+	}
+
+	void reportThroughput(const std::string& name, u64 numOperations, steady_clock::duration duration)
+	{
+		f64 seconds = duration_cast<microseconds>(duration).count() / 1e6;
+		tlog::info() << StrFormat("{0}: {1} operations in {2}ms ({3} per second)", name, numOperations, (s64)(seconds * 1000), (s64)(numOperations / std::max(seconds, 1e-9)));
+	}
+
+	void reportLatency(const std::string& name, std::vector<f64> latencies)
+	{
+		check(!latencies.empty(), "latencies were measured");
+
+		std::sort(std::begin(latencies), std::end(latencies));
+
+		auto percentile = [&latencies](f64 p)
+		{
+			return latencies[std::min((size_t)(p * latencies.size()), latencies.size() - 1)];
+		};
+
+		tlog::info() << StrFormat(
+			"{0}: wakeup latency median {1}us, p99 {2}us, max {3}us",
+			name, percentile(0.5), percentile(0.99), latencies.back()
+		);
+	}
+
+	f64 microsecondsSince(steady_clock::time_point time)
+	{
+		return duration_cast<nanoseconds>(steady_clock::now() - time).count() / 1000.0;
+	}
+
+	void testSharedQueue()
+	{
+		static const u32 s_numItemsPerProducer = 100000;
+		static const u32 s_numLatencySamples = 1000;
+
+		// Every item is popped exactly once, however producers and consumers interleave
+		{
+			SharedQueue<u64> queue;
+			std::atomic<u64> sum{0};
+			std::atomic<u64> numPopped{0};
+
+			u32 numProducers = s_numThreads / 2;
+			u32 numConsumers = s_numThreads - numProducers;
+			u64 numItems = (u64)numProducers * s_numItemsPerProducer;
+
+			auto startTime = steady_clock::now();
+
+			withinDeadline("SharedQueue stress", [&]()
+			{
+				std::vector<std::thread> threads;
+
+				for (u32 i = 0; i < numConsumers; ++i)
+				{
+					threads.emplace_back([&]()
+					{
+						while (true)
+						{
+							u64 item = queue.WaitAndPop();
+
+							// Sentinel to stop
+							if (item == 0)
+								return;
+
+							sum += item;
+							++numPopped;
+						}
+					});
+				}
+
+				for (u32 i = 0; i < numProducers; ++i)
+				{
+					threads.emplace_back([&]()
+					{
+						for (u64 item = 1; item <= s_numItemsPerProducer; ++item)
+							queue.Push(item);
+					});
+				}
+
+				for (u32 i = numConsumers; i < threads.size(); ++i)
+					threads[i].join();
+
+				for (u32 i = 0; i < numConsumers; ++i)
+				{
+					u64 sentinel = 0;
+					queue.Push(sentinel);
+				}
+
+				for (u32 i = 0; i < numConsumers; ++i)
+					threads[i].join();
+			});
+
+			reportThroughput("SharedQueue push/pop", numItems, steady_clock::now() - startTime);
+
+			check(numPopped == numItems, "every pushed item was popped");
+			check(sum == (u64)numProducers * s_numItemsPerProducer * (s_numItemsPerProducer + 1) / 2, "no item was popped twice");
+			check(queue.Empty(), "the queue is empty afterwards");
+		}
+
+		// A consumer waiting on the empty queue wakes up for every single push
+		{
+			SharedQueue<steady_clock::time_point> queue;
+			std::vector<f64> latencies;
+
+			withinDeadline("SharedQueue wakeup", [&]()
+			{
+				std::thread consumer{[&]()
+				{
+					for (u32 i = 0; i < s_numLatencySamples; ++i)
+						latencies.emplace_back(microsecondsSince(queue.WaitAndPop()));
+				}};
+
+				for (u32 i = 0; i < s_numLatencySamples; ++i)
+				{
+					// Give the consumer time to go back to sleep
+					std::this_thread::sleep_for(microseconds{100});
+
+					auto now = steady_clock::now();
+					queue.Push(now);
+				}
+
+				consumer.join();
+			});
+
+			reportLatency("SharedQueue", latencies);
+		}
+	}
+
+	void testActive()
+	{
+		static const u32 s_numTasks = 100000;
+		static const u32 s_numLatencySamples = 1000;
+
+		// Tasks run in order, one after another
+		{
+			auto pActive = Active::Create();
+			u32 numExecuted = 0;
+			bool isOrdered = true;
+
+			auto startTime = steady_clock::now();
+
+			for (u32 i = 0; i < s_numTasks; ++i)
+			{
+				pActive->Send([&numExecuted, &isOrdered, i]()
+				{
+					isOrdered = isOrdered && numExecuted == i;
+					++numExecuted;
+				});
+			}
+
+			withinDeadline("Active stress", [&]()
+			{
+				while (pActive->IsBusy())
+					std::this_thread::yield();
+			});
+
+			reportThroughput("Active send", s_numTasks, steady_clock::now() - startTime);
+
+			check(numExecuted == s_numTasks, "all tasks were executed");
+			check(isOrdered, "tasks were executed in order");
+		}
+
+		// Regression: the task being executed counts as pending, such that waiting for no pending
+		// tasks also waits for it to finish. Database connections rely on this when flushing.
+		{
+			auto pActive = Active::Create();
+
+			for (u32 i = 0; i < 100; ++i)
+			{
+				std::atomic<bool> isFinished{false};
+				pActive->Send([&isFinished]()
+				{
+					std::this_thread::sleep_for(microseconds{200});
+					isFinished = true;
+				});
+
+				withinDeadline("Active pending", [&]()
+				{
+					while (pActive->NumPending() > 0)
+						std::this_thread::yield();
+				});
+
+				check(isFinished, "no tasks are pending only once the last one finished");
+			}
+		}
+
+		{
+			auto pActive = Active::Create();
+			std::vector<f64> latencies;
+
+			for (u32 i = 0; i < s_numLatencySamples; ++i)
+			{
+				std::this_thread::sleep_for(microseconds{100});
+
+				auto sendTime = steady_clock::now();
+				pActive->Send([&latencies, sendTime]() { latencies.emplace_back(microsecondsSince(sendTime)); });
+			}
+
+			withinDeadline("Active wakeup", [&]()
+			{
+				while (pActive->IsBusy())
+					std::this_thread::sleep_for(milliseconds{1});
+			});
+
+			reportLatency("Active", latencies);
+		}
+	}
+
+	void testThreadPool()
+	{
+		static const u32 s_numTasks = 200000;
+		static const u32 s_numLatencySamples = 1000;
+
+		// All tasks enqueued from several threads complete before WaitUntilFinished returns
+		{
+			ThreadPool threadPool{s_numThreads};
+			std::atomic<u32> numExecuted{0};
+
+			auto startTime = steady_clock::now();
+
+			withinDeadline("ThreadPool stress", [&]()
+			{
+				std::vector<std::thread> producers;
+				for (u32 i = 0; i < 4; ++i)
+				{
+					producers.emplace_back([&]()
+					{
+						for (u32 j = 0; j < s_numTasks / 4; ++j)
+							threadPool.EnqueueTask([&numExecuted]() { ++numExecuted; });
+					});
+				}
+
+				for (auto& producer : producers)
+					producer.join();
+
+				threadPool.WaitUntilFinished();
+			});
+
+			reportThroughput("ThreadPool enqueue/execute", s_numTasks, steady_clock::now() - startTime);
+
+			check(numExecuted == s_numTasks, "WaitUntilFinished returns only once all tasks were executed");
+			check(threadPool.GetNumTasksInSystem() == 0, "no tasks are left in the system");
+		}
+
+		// Regression: WaitUntilFinished must not return on a spurious or early wakeup while tasks are still
+		// in the system. Every round, the last task runs long after the first ones notified the waiter.
+		{
+			ThreadPool threadPool{s_numThreads};
+
+			for (u32 round = 0; round < 100; ++round)
+			{
+				std::atomic<u32> numExecuted{0};
+
+				for (u32 i = 0; i < s_numThreads; ++i)
+				{
+					threadPool.EnqueueTask([&numExecuted, i]()
+					{
+						std::this_thread::sleep_for(microseconds{i * 50});
+						++numExecuted;
+					});
+				}
+
+				withinDeadline("ThreadPool wait", [&]() { threadPool.WaitUntilFinished(); });
+				check(numExecuted == s_numThreads, "WaitUntilFinished waited for all tasks");
+
+				threadPool.WaitUntilFinishedFor(microseconds{0});
+				check(threadPool.GetNumTasksInSystem() == 0, "WaitUntilFinishedFor returns right away when idle");
+			}
+		}
+
+		// Regression: flushing the queue while no task runs has to wake up those waiting for the pool to become idle
+		{
+			ThreadPool threadPool{0};
+
+			for (u32 i = 0; i < 1000; ++i)
+				threadPool.EnqueueTask([]() {});
+
+			std::atomic<bool> isWaiting{false};
+
+			withinDeadline("ThreadPool flush", [&]()
+			{
+				std::thread waiter{[&]()
+				{
+					isWaiting = true;
+					threadPool.WaitUntilFinished();
+				}};
+
+				while (!isWaiting)
+					std::this_thread::yield();
+
+				// Make it likely the waiter is asleep already
+				std::this_thread::sleep_for(milliseconds{10});
+
+				threadPool.FlushQueue();
+				waiter.join();
+			});
+
+			check(threadPool.GetNumTasksInSystem() == 0, "flushing removed all tasks");
+		}
+
+		// Regression: threads started while tasks are queued already pick them up, also when they are
+		// repeatedly started and shut down
+		{
+			ThreadPool threadPool{0};
+			std::atomic<u32> numExecuted{0};
+
+			for (u32 round = 0; round < 20; ++round)
+			{
+				for (u32 i = 0; i < 1000; ++i)
+					threadPool.EnqueueTask([&numExecuted]() { ++numExecuted; });
+
+				threadPool.StartThreads(s_numThreads);
+
+				withinDeadline("ThreadPool start", [&]() { threadPool.WaitUntilFinished(); });
+
+				threadPool.ShutdownThreads(s_numThreads);
+			}
+
+			check(numExecuted == 20 * 1000, "started threads executed all queued tasks");
+		}
+
+		{
+			ThreadPool threadPool{s_numThreads};
+			std::vector<f64> latencies;
+			std::mutex latenciesMutex;
+
+			for (u32 i = 0; i < s_numLatencySamples; ++i)
+			{
+				std::this_thread::sleep_for(microseconds{100});
+
+				auto enqueueTime = steady_clock::now();
+				threadPool.EnqueueTask([&latencies, &latenciesMutex, enqueueTime]()
+				{
+					f64 latency = microsecondsSince(enqueueTime);
+
+					std::lock_guard<std::mutex> lock{latenciesMutex};
+					latencies.emplace_back(latency);
+				});
+			}
+
+			withinDeadline("ThreadPool wakeup", [&]() { threadPool.WaitUntilFinished(); });
+
+			reportLatency("ThreadPool", latencies);
+		}
+	}
+
+	void testRWMutex()
+	{
+		static const u32 s_numOperationsPerThread = 100000;
+
+		// Readers never see a half written value, and neither readers nor other writers overlap with a writer
+		{
+			RWMutex mutex;
+			u64 first = 0;
+			u64 second = 0;
+
+			std::atomic<s32> numReaders{0};
+			std::atomic<s32> numWriters{0};
+			std::atomic<bool> isConsistent{true};
+
+			auto startTime = steady_clock::now();
+
+			withinDeadline("RWMutex stress", [&]()
+			{
+				std::vector<std::thread> threads;
+				for (u32 i = 0; i < s_numThreads; ++i)
+				{
+					// Every fourth thread writes
+					bool isWriter = i % 4 == 0;
+
+					threads.emplace_back([&, isWriter]()
+					{
+						for (u32 j = 0; j < s_numOperationsPerThread; ++j)
+						{
+							RWLock lock{&mutex, isWriter};
+
+							if (isWriter)
+							{
+								if (++numWriters != 1 || numReaders != 0)
+									isConsistent = false;
+
+								++first;
+								++second;
+
+								--numWriters;
+							}
+							else
+							{
+								++numReaders;
+								if (numWriters != 0 || first != second)
+									isConsistent = false;
+
+								--numReaders;
+							}
+						}
+					});
+				}
+
+				for (auto& thread : threads)
+					thread.join();
+			});
+
+			reportThroughput("RWMutex lock/unlock", (u64)s_numThreads * s_numOperationsPerThread, steady_clock::now() - startTime);
+
+			check(isConsistent, "writers were exclusive");
+			check(first == second && first == (u64)((s_numThreads + 3) / 4) * s_numOperationsPerThread, "all writes happened");
+		}
+
+		// Writers are preferred, hence a writer gets in even though readers keep on holding the lock. This is
+		// the wakeup new beatmaps depend on while scores are processed.
+		{
+			RWMutex mutex;
+			std::atomic<bool> shallStop{false};
+			std::vector<f64> latencies;
+
+			withinDeadline("RWMutex writer", [&]()
+			{
+				std::vector<std::thread> readers;
+				for (u32 i = 0; i < s_numThreads; ++i)
+				{
+					readers.emplace_back([&]()
+					{
+						while (!shallStop)
+						{
+							RWLock lock{&mutex, false};
+							std::this_thread::sleep_for(microseconds{50});
+						}
+					});
+				}
+
+				for (u32 i = 0; i < 200; ++i)
+				{
+					std::this_thread::sleep_for(microseconds{200});
+
+					auto lockTime = steady_clock::now();
+					RWLock lock{&mutex, true};
+					latencies.emplace_back(microsecondsSince(lockTime));
+				}
+
+				shallStop = true;
+				for (auto& reader : readers)
+					reader.join();
+			});
+
+			reportLatency("RWMutex writer", latencies);
+		}
+	}
+
+	void testPriorityMutex()
+	{
+		static const u32 s_numOperationsPerThread = 100000;
+
+		// Both priorities are mutually exclusive
+		{
+			PriorityMutex mutex;
+			u64 counter = 0;
+
+			auto startTime = steady_clock::now();
+
+			withinDeadline("PriorityMutex stress", [&]()
+			{
+				std::vector<std::thread> threads;
+				for (u32 i = 0; i < s_numThreads; ++i)
+				{
+					bool isHighPriority = i % 2 == 0;
+					threads.emplace_back([&, isHighPriority]()
+					{
+						for (u32 j = 0; j < s_numOperationsPerThread; ++j)
+						{
+							PriorityLock lock{&mutex, isHighPriority};
+							++counter;
+						}
+					});
+				}
+
+				for (auto& thread : threads)
+					thread.join();
+			});
+
+			reportThroughput("PriorityMutex lock/unlock", (u64)s_numThreads * s_numOperationsPerThread, steady_clock::now() - startTime);
+
+			check(counter == (u64)s_numThreads * s_numOperationsPerThread, "no increment was lost");
+		}
+
+		// A high priority locker overtakes the low priority ones contending for the lock
+		{
+			PriorityMutex mutex;
+			std::atomic<bool> shallStop{false};
+			std::vector<f64> latencies;
+
+			withinDeadline("PriorityMutex high priority", [&]()
+			{
+				std::vector<std::thread> threads;
+				for (u32 i = 0; i < s_numThreads; ++i)
+				{
+					threads.emplace_back([&]()
+					{
+						while (!shallStop)
+						{
+							PriorityLock lock{&mutex, false};
+							std::this_thread::sleep_for(microseconds{50});
+						}
+					});
+				}
+
+				for (u32 i = 0; i < 200; ++i)
+				{
+					std::this_thread::sleep_for(microseconds{200});
+
+					auto lockTime = steady_clock::now();
+					PriorityLock lock{&mutex, true};
+					latencies.emplace_back(microsecondsSince(lockTime));
+				}
+
+				shallStop = true;
+				for (auto& thread : threads)
+					thread.join();
+			});
+
+			reportLatency("PriorityMutex high priority", latencies);
+		}
+	}
+}
+
+int main(s32 argc, char* argv[])
+{
+	const std::map<std::string, std::function<void()>> tests = {
+		{"shared-queue",   testSharedQueue},
+		{"active",         testActive},
+		{"thread-pool",    testThreadPool},
+		{"rw-mutex",       testRWMutex},
+		{"priority-mutex", testPriorityMutex},
+	};
+
+	std::vector<std::string> names;
+	for (s32 i = 1; i < argc; ++i)
+		names.emplace_back(argv[i]);
+
+	// Run everything by default
+	if (names.empty())
+		for (const auto& test : tests)
+			names.emplace_back(test.first);
+
+	try
+	{
+		for (const auto& name : names)
+		{
+			auto testIt = tests.find(name);
+			if (testIt == std::end(tests))
+				throw TestException{SRC_POS, StrFormat("Unknown test '{0}'.", name)};
+
+			tlog::info() << StrFormat("Running '{0}' with {1} threads.", name, s_numThreads);
+			testIt->second();
+			tlog::success() << StrFormat("'{0}' passed.", name);
+		}
+	}
+	catch (const Exception&)
+	{
+		// Already logged upon construction
+		return 1;
+	}
+
+	return 0;
+}
+
+PP_NAMESPACE_END
+
+int main(s32 argc, char* argv[])
+{
+	return pp::main(argc, argv);
+}